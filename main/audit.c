@@ -0,0 +1,389 @@
+/* Append-only audit log
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <esp_log.h>
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "audit.h"
+#include "hid_task.h"
+
+/* Should put these in .h file(s) */
+extern const char *TAG;
+
+/* Every flash sector starts with a header slot naming the record number of
+ * its first record; the other slots hold records in order. Slots are only
+ * ever written once after an erase, so the write position is the first
+ * erased slot of the sector with the highest first record number. */
+#define AUDIT_SECTOR        4096                // Flash erase unit
+#define AUDIT_SLOTS         (AUDIT_SECTOR / sizeof(audit_record_t))
+#define AUDIT_PER_SECTOR    (AUDIT_SLOTS - 1)
+#define AUDIT_MAX_SECTORS   64
+#define AUDIT_MAGIC         0x4C414B57          // "WKAL"
+#define AUDIT_VERSION       1
+#define AUDIT_UNUSED        0xFFFFFFFF
+
+#define AUDIT_QUEUE_LEN     16
+#define AUDIT_BATCH_MS      200                 // Write once appends are this far apart
+#define AUDIT_STACK_SIZE    3072
+#define AUDIT_CLOCK_SET     1600000000          // Earlier times are the clock before SNTP
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t first_seq;         // Record number in slot 1
+    uint32_t erases;            // Times this sector has been erased
+    uint16_t boot;              // Boot count when the sector was started
+    uint8_t reserved[10];
+    uint32_t crc;
+} audit_sector_t;
+
+_Static_assert(sizeof(audit_sector_t) == sizeof(audit_record_t), "sector header fills one slot");
+
+static const char *const audit_type_names[] = {
+    "none", "boot", "ctrl", "arm", "disarm", "seq_end", "type", "power", "consumer",
+};
+
+static const char *const audit_source_names[] = {
+    "device", "http", "https", "udp", "armed",
+};
+
+/* Local storage */
+static const esp_partition_t *audit_part = NULL;
+static uint32_t audit_sectors = 0;
+static uint32_t audit_first[AUDIT_MAX_SECTORS];     // Per sector, AUDIT_UNUSED if not started
+static uint32_t audit_head = 0;                     // Sector being filled
+static uint32_t audit_next = 0;                     // Number of the next record written
+static uint16_t audit_boot = 0;
+static QueueHandle_t audit_queue = NULL;
+static SemaphoreHandle_t audit_lock = NULL;         // Flash and sector table, writer vs readers
+static audit_record_t audit_batch[AUDIT_QUEUE_LEN];
+
+/* Statistics for /status */
+static uint32_t audit_dropped = 0;
+static uint32_t audit_writes = 0;
+static uint32_t audit_errors = 0;
+static uint32_t audit_wear = 0;                     // Most erases of any sector
+
+static uint32_t audit_crc(const void *data, size_t len)
+{
+    return esp_rom_crc32_le(0, data, len);
+}
+
+static bool audit_erased(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+static uint32_t audit_sector_offset(uint32_t sector, uint32_t slot)
+{
+    return sector * AUDIT_SECTOR + slot * sizeof(audit_record_t);
+}
+
+/* Sector holding record number seq, -1 if it is no longer (or not yet) in flash */
+static int audit_sector_of(uint32_t seq)
+{
+    for (int i = 0; i < audit_sectors; i++) {
+        if ((audit_first[i] != AUDIT_UNUSED) && (seq - audit_first[i] < AUDIT_PER_SECTOR))
+            return i;
+    }
+    return -1;
+}
+
+static uint32_t audit_oldest(void)
+{
+    uint32_t first = audit_next;
+
+    for (int i = 0; i < audit_sectors; i++) {
+        if ((audit_first[i] != AUDIT_UNUSED) && ((int32_t) (audit_first[i] - first) < 0))
+            first = audit_first[i];
+    }
+    return first;
+}
+
+/* Erase a sector and start it at record number first_seq, the records it held are gone */
+static void audit_start_sector(uint32_t sector, uint32_t first_seq)
+{
+    audit_sector_t hdr;
+    uint32_t erases = 0;
+    esp_err_t err;
+
+    if ((esp_partition_read(audit_part, audit_sector_offset(sector, 0), &hdr, sizeof(hdr)) == ESP_OK) &&
+        (hdr.magic == AUDIT_MAGIC) && (hdr.crc == audit_crc(&hdr, offsetof(audit_sector_t, crc))))
+        erases = hdr.erases;
+
+    audit_first[sector] = AUDIT_UNUSED;
+    audit_head = sector;
+    memset(&hdr, 0xFF, sizeof(hdr));
+    hdr.magic = AUDIT_MAGIC;
+    hdr.version = AUDIT_VERSION;
+    hdr.record_size = sizeof(audit_record_t);
+    hdr.first_seq = first_seq;
+    hdr.erases = erases + 1;
+    hdr.boot = audit_boot;
+    hdr.crc = audit_crc(&hdr, offsetof(audit_sector_t, crc));
+    err = esp_partition_erase_range(audit_part, audit_sector_offset(sector, 0), AUDIT_SECTOR);
+    if (err == ESP_OK)
+        err = esp_partition_write(audit_part, audit_sector_offset(sector, 0), &hdr, sizeof(hdr));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Error (%s) starting audit sector %u", esp_err_to_name(err), sector);
+        audit_errors++;
+    }
+    /* A failed sector is still used, its records just fail the CRC */
+    audit_first[sector] = first_seq;
+    audit_wear = MAX(audit_wear, hdr.erases);
+}
+
+/* Write queued records, splitting the batch where a sector fills */
+static void audit_write(audit_record_t *recs, int count)
+{
+    xSemaphoreTake(audit_lock, portMAX_DELAY);
+    while (count > 0) {
+        uint32_t const slot = 1 + audit_next - audit_first[audit_head];
+        int n;
+        esp_err_t err;
+
+        if (slot >= AUDIT_SLOTS) {
+            audit_start_sector((audit_head + 1) % audit_sectors, audit_next);
+            continue;
+        }
+        n = MIN(count, AUDIT_SLOTS - slot);
+        for (int i = 0; i < n; i++) {
+            recs[i].seq = audit_next + i;
+            recs[i].crc = audit_crc(&recs[i], offsetof(audit_record_t, crc));
+        }
+        err = esp_partition_write(audit_part, audit_sector_offset(audit_head, slot), recs, n * sizeof(recs[0]));
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Error (%s) writing audit records", esp_err_to_name(err));
+            audit_errors++;
+        }
+        audit_writes++;
+        audit_next += n;
+        recs += n;
+        count -= n;
+    }
+    xSemaphoreGive(audit_lock);
+}
+
+/* Collect appends until they stop coming, then write them in one go. Flash
+ * writes stall the caches, so they wait for a running key sequence to end
+ * unless the queue is close to full. */
+static void audit_task(void *param)
+{
+    (void) param;
+
+    while (1) {
+        int n = 0;
+
+        xQueueReceive(audit_queue, &audit_batch[n++], portMAX_DELAY);
+        while ((n < AUDIT_QUEUE_LEN) &&
+               (xQueueReceive(audit_queue, &audit_batch[n], pdMS_TO_TICKS(AUDIT_BATCH_MS)) == pdTRUE))
+            n++;
+        while ((n < AUDIT_QUEUE_LEN - 2) && hid_busy()) {
+            if (xQueueReceive(audit_queue, &audit_batch[n], pdMS_TO_TICKS(AUDIT_BATCH_MS)) == pdTRUE)
+                n++;
+        }
+        audit_write(audit_batch, n);
+    }
+}
+
+/* Find where writing stopped, sectors fill in order and slots within them */
+static void audit_recover(void)
+{
+    audit_sector_t hdr;
+    audit_record_t rec;
+    int head = -1;
+    uint32_t lo, hi;
+
+    for (int i = 0; i < audit_sectors; i++) {
+        audit_first[i] = AUDIT_UNUSED;
+        if ((esp_partition_read(audit_part, audit_sector_offset(i, 0), &hdr, sizeof(hdr)) != ESP_OK) ||
+            (hdr.magic != AUDIT_MAGIC) || (hdr.version != AUDIT_VERSION) ||
+            (hdr.crc != audit_crc(&hdr, offsetof(audit_sector_t, crc))))
+            continue;
+        audit_first[i] = hdr.first_seq;
+        audit_wear = MAX(audit_wear, hdr.erases);
+        audit_boot = MAX(audit_boot, hdr.boot);
+        if ((head < 0) || ((int32_t) (hdr.first_seq - audit_first[head]) > 0))
+            head = i;
+    }
+    if (head < 0) {
+        ESP_LOGI(TAG, "Starting a new audit log");
+        audit_boot = 1;
+        audit_next = 0;
+        audit_start_sector(0, 0);
+        return;
+    }
+
+    /* First erased slot of the head sector */
+    lo = 1;
+    hi = AUDIT_SLOTS;
+    while (lo < hi) {
+        uint32_t const mid = (lo + hi) / 2;
+        if ((esp_partition_read(audit_part, audit_sector_offset(head, mid), &rec, sizeof(rec)) == ESP_OK) &&
+            audit_erased(&rec, sizeof(rec)))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    audit_head = head;
+    audit_next = audit_first[head] + lo - 1;
+
+    /* Boot count follows the newest record that survived */
+    if (audit_next != audit_oldest()) {
+        uint32_t cursor = audit_next - 1;
+        if (audit_read(&cursor, &rec, 1) == 1)
+            audit_boot = MAX(audit_boot, rec.boot);
+    }
+    audit_boot++;
+}
+
+void audit_init(void)
+{
+    static StaticQueue_t queue_def;
+    static uint8_t queue_storage[AUDIT_QUEUE_LEN * sizeof(audit_record_t)];
+
+    audit_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "audit");
+    if (audit_part == NULL) {
+        ESP_LOGW(TAG, "No audit partition, not logging");
+        return;
+    }
+    audit_sectors = MIN(audit_part->size / AUDIT_SECTOR, AUDIT_MAX_SECTORS);
+    if (audit_sectors < 2) {
+        ESP_LOGW(TAG, "Audit partition too small, not logging");
+        audit_part = NULL;
+        return;
+    }
+
+    audit_lock = xSemaphoreCreateMutex();
+    audit_recover();
+    ESP_LOGI(TAG, "Audit log has records %u to %u, boot %u", audit_oldest(), audit_next, audit_boot);
+
+    audit_queue = xQueueCreateStatic(AUDIT_QUEUE_LEN, sizeof(audit_record_t), queue_storage, &queue_def);
+    audit_append(&(audit_record_t) { .type = AUDIT_BOOT, .source = AUDIT_SRC_DEVICE, .arg = esp_reset_reason() });
+    xTaskCreate(audit_task, "audit", AUDIT_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1, NULL);
+}
+
+bool audit_append(const audit_record_t *rec)
+{
+    audit_record_t r = *rec;
+    time_t const now = time(NULL);
+
+    if (audit_queue == NULL)
+        return false;
+    r.time = (now >= AUDIT_CLOCK_SET) ? (uint32_t) now : 0;
+    r.uptime_ms = esp_timer_get_time() / 1000;
+    r.boot = audit_boot;
+    if (xQueueSend(audit_queue, &r, 0) != pdTRUE) {
+        audit_dropped++;
+        return false;
+    }
+    return true;
+}
+
+void audit_range(uint32_t *first, uint32_t *next)
+{
+    if (audit_part == NULL) {
+        *first = *next = 0;
+        return;
+    }
+    xSemaphoreTake(audit_lock, portMAX_DELAY);
+    *first = audit_oldest();
+    *next = audit_next;
+    xSemaphoreGive(audit_lock);
+}
+
+int audit_read(uint32_t *cursor, audit_record_t *recs, int max)
+{
+    int count = 0;
+
+    if (audit_part == NULL)
+        return 0;
+    xSemaphoreTake(audit_lock, portMAX_DELAY);
+    if ((int32_t) (*cursor - audit_oldest()) < 0)
+        *cursor = audit_oldest();
+    while ((count < max) && ((int32_t) (audit_next - *cursor) > 0)) {
+        int const sector = audit_sector_of(*cursor);
+        uint32_t slot;
+        int n;
+
+        if (sector < 0) {
+            /* A sector that could not be started, go on with the next one */
+            uint32_t skip = audit_next;
+            for (int i = 0; i < audit_sectors; i++) {
+                if ((audit_first[i] != AUDIT_UNUSED) && ((int32_t) (audit_first[i] - *cursor) > 0) &&
+                    ((int32_t) (audit_first[i] - skip) < 0))
+                    skip = audit_first[i];
+            }
+            *cursor = skip;
+            continue;
+        }
+        slot = 1 + *cursor - audit_first[sector];
+        n = MIN(MIN(max - count, AUDIT_SLOTS - slot), audit_next - *cursor);
+        if (esp_partition_read(audit_part, audit_sector_offset(sector, slot), &recs[count], n * sizeof(recs[0])) != ESP_OK)
+            n = 0;
+
+        /* Keep the records that are whole, in place */
+        audit_record_t *const read = &recs[count];
+        for (int i = 0; i < n; i++) {
+            if ((read[i].seq == *cursor + i) && (read[i].crc == audit_crc(&read[i], offsetof(audit_record_t, crc)))) {
+                if (&recs[count] != &read[i])
+                    memcpy(&recs[count], &read[i], sizeof(read[i]));
+                count++;
+            }
+        }
+        *cursor += MAX(n, 1);
+    }
+    xSemaphoreGive(audit_lock);
+    return count;
+}
+
+int audit_record_json(const audit_record_t *rec, char *buf, size_t len)
+{
+    const uint8_t *ip = (const uint8_t *) &rec->addr;
+
+    return snprintf(buf, len,
+                    "{\"seq\":%u,\"time\":%u,\"uptime_ms\":%u,\"boot\":%u,\"type\":\"%s\",\"source\":\"%s\","
+                    "\"addr\":\"%u.%u.%u.%u\",\"btn\":%u,\"mode\":%u,\"result\":%u,\"signed\":%s,\"arg\":%u}",
+                    rec->seq, rec->time, rec->uptime_ms, rec->boot,
+                    (rec->type < sizeof(audit_type_names) / sizeof(audit_type_names[0])) ? audit_type_names[rec->type] : "?",
+                    (rec->source < sizeof(audit_source_names) / sizeof(audit_source_names[0])) ? audit_source_names[rec->source] : "?",
+                    ip[0], ip[1], ip[2], ip[3], rec->btn, rec->mode, rec->result,
+                    (rec->flags & AUDIT_F_SIGNED) ? "true" : "false", rec->arg);
+}
+
+int audit_status_json(char *buf, size_t len)
+{
+    uint32_t first, next;
+
+    audit_range(&first, &next);
+    return snprintf(buf, len,
+                    "\"audit\":{\"enabled\":%s,\"first\":%u,\"next\":%u,\"boot\":%u,\"sectors\":%u,\"wear\":%u,"
+                    "\"writes\":%u,\"dropped\":%u,\"errors\":%u}",
+                    audit_part ? "true" : "false", first, next, audit_boot, audit_sectors, audit_wear,
+                    audit_writes, audit_dropped, audit_errors);
+}
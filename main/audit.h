@@ -0,0 +1,88 @@
+/* Append-only audit log
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef AUDIT_H_
+#define AUDIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Who asked for which selection and how each sequence ended, kept in the
+ * "audit" data partition. Records are fixed size and numbered; the
+ * partition is a ring of flash sectors that are erased in turn, so the
+ * oldest sector goes when the newest is full and every sector wears evenly.
+ * Appends are queued and written in batches by a low priority task. */
+
+typedef enum
+{
+    AUDIT_NONE = 0,
+    AUDIT_BOOT,                 // Webkey started, arg = esp_reset_reason_t
+    AUDIT_CTRL,                 // Key sequence requested, result = CTRL_ST_*
+    AUDIT_ARM,                  // Selection armed, result = CTRL_ST_*
+    AUDIT_DISARM,               // Armed selection cleared, result = CTRL_ST_*
+    AUDIT_SEQ_END,              // Key sequence finished, result = 0 ok / 1 restart / 2 timeout / 3 aborted, arg = ms
+    AUDIT_TYPE,                 // Text to type, mode = keymap layout, arg = length (the text is not kept)
+    AUDIT_POWER,                // System Control, mode = HID_POWER_*, result = CTRL_ST_*
+    AUDIT_CONSUMER,             // Consumer Control, arg = usage, result = CTRL_ST_*
+} audit_type_t;
+
+/* Where a request came from */
+typedef enum
+{
+    AUDIT_SRC_DEVICE = 0,       // The webkey itself
+    AUDIT_SRC_HTTP,
+    AUDIT_SRC_HTTPS,
+    AUDIT_SRC_UDP,
+    AUDIT_SRC_ARMED,            // Armed selection fired on host enumeration
+} audit_source_t;
+
+#define AUDIT_F_SIGNED      0x01        // Request carried a valid signature
+
+typedef struct
+{
+    uint32_t seq;               // Record number, never reused
+    uint32_t time;              // Unix time (s), 0 before SNTP has set the clock
+    uint32_t uptime_ms;
+    uint16_t boot;              // Boot count, kept by the log itself
+    uint8_t type;               // audit_type_t
+    uint8_t source;             // audit_source_t
+    uint32_t addr;              // Client IPv4 address, network byte order
+    uint8_t btn;
+    uint8_t mode;
+    uint8_t result;
+    uint8_t flags;              // AUDIT_F_*
+    uint32_t arg;
+    uint32_t crc;               // CRC-32 of the bytes before it
+} audit_record_t;
+
+_Static_assert(sizeof(audit_record_t) == 32, "audit records are 32 bytes in flash");
+
+/* Find the partition, recover the write position and start the writer */
+void audit_init(void);
+
+/* Queue a record, filling in seq, time, uptime, boot and crc. Never waits;
+ * returns false if the log is missing or the queue is full. */
+bool audit_append(const audit_record_t *rec);
+
+/* Record numbers still in flash are [*first, *next) */
+void audit_range(uint32_t *first, uint32_t *next);
+
+/* Copy up to max records from *cursor on, oldest first, and move the cursor
+ * past them. Records lost to an interrupted write are skipped. Returns the
+ * number copied, 0 once the cursor reaches the end. */
+int audit_read(uint32_t *cursor, audit_record_t *recs, int max);
+
+/* Format one record as a JSON object, returns length */
+int audit_record_json(const audit_record_t *rec, char *buf, size_t len);
+
+/* Write the "audit" member of /status */
+int audit_status_json(char *buf, size_t len);
+
+#endif /* AUDIT_H_ */
@@ -0,0 +1,218 @@
+/* Device key and message authentication
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <esp_log.h>
+#include <nvs_flash.h>
+#include "esp_sntp.h"
+#include "mbedtls/md.h"
+
+#include "auth.h"
+
+/* Should put these in .h file(s) */
+extern const char *TAG;
+
+#define AUTH_WINDOW_S       CONFIG_WEBKEY_AUTH_WINDOW
+#define AUTH_NONCES         64
+
+typedef struct
+{
+    int64_t ts;             // 0 for an empty slot
+    uint64_t nonce;
+} auth_nonce_t;
+
+/* Local storage */
+static uint8_t auth_key[AUTH_KEY_LEN];
+static bool auth_key_set = false;
+static volatile bool auth_time_synced = false;
+static int64_t auth_newest = 0;         // Newest timestamp accepted
+static int64_t auth_floor = 0;          // Mark from before boot, timestamps must be past it
+static int64_t auth_mark = 0;           // In NVS (AUTH_MARK), the newest timestamp accepted
+static SemaphoreHandle_t auth_mark_mutex = NULL;
+static StaticSemaphore_t auth_mark_mutex_buf;
+static auth_nonce_t auth_nonces[AUTH_NONCES];
+static portMUX_TYPE auth_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void auth_time_sync_cb(struct timeval *tv)
+{
+    if (!auth_time_synced)
+        ESP_LOGI(TAG, "Time synchronized");
+    auth_time_synced = true;
+}
+
+/* Save a new mark before a request past the old one is accepted. The nonce
+ * cache starts empty every boot, so the requests accepted before it are only
+ * kept out by the mark. Timestamps are whole seconds, so requests write at
+ * most once a second, and a current request right after a reboot is past it. */
+static esp_err_t auth_mark_reserve(int64_t mark)
+{
+    nvs_handle_t nvsHandle;
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(auth_mark_mutex, portMAX_DELAY);
+    if (mark > auth_mark) {
+        err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+        if (err == ESP_OK) {
+            err = nvs_set_i64(nvsHandle, "AUTH_MARK", mark);
+            if (err == ESP_OK)
+                err = nvs_commit(nvsHandle);
+            nvs_close(nvsHandle);
+        }
+        if (err == ESP_OK) {
+            portENTER_CRITICAL(&auth_lock);
+            auth_mark = mark;
+            portEXIT_CRITICAL(&auth_lock);
+        } else {
+            ESP_LOGE(TAG, "Error (%s) writing request time mark", esp_err_to_name(err));
+        }
+    }
+    xSemaphoreGive(auth_mark_mutex);
+    return err;
+}
+
+/* Load the device key and the replay mark */
+void auth_init(void)
+{
+    nvs_handle_t nvsHandle;
+    size_t len = sizeof(auth_key);
+
+    auth_mark_mutex = xSemaphoreCreateMutexStatic(&auth_mark_mutex_buf);
+    if (nvs_open("storage", NVS_READONLY, &nvsHandle) != ESP_OK)
+        return;
+    if ((nvs_get_blob(nvsHandle, "AUTH_KEY", auth_key, &len) == ESP_OK) && (len == sizeof(auth_key)))
+        auth_key_set = true;
+    if (nvs_get_i64(nvsHandle, "AUTH_MARK", &auth_mark) == ESP_OK)
+        auth_floor = auth_mark;
+    nvs_close(nvsHandle);
+    ESP_LOGI(TAG, "Device key %s", auth_key_set ? "set" : "not set, control is open");
+
+    /* Wall clock time for the replay window */
+    if (strlen(CONFIG_WEBKEY_SNTP_SERVER) > 0) {
+        sntp_setoperatingmode(SNTP_OPMODE_POLL);
+        sntp_setservername(0, CONFIG_WEBKEY_SNTP_SERVER);
+        sntp_set_time_sync_notification_cb(auth_time_sync_cb);
+        sntp_init();
+    }
+}
+
+bool auth_enabled(void)
+{
+    return auth_key_set;
+}
+
+static int hex_nibble(char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
+
+bool auth_parse_hex(const char *hex, uint8_t *out, size_t len)
+{
+    if (strlen(hex) != 2 * len)
+        return false;
+    for (int i = 0; i < len; i++) {
+        int hi = hex_nibble(hex[2 * i]);
+        int lo = hex_nibble(hex[2 * i + 1]);
+        if ((hi < 0) || (lo < 0))
+            return false;
+        out[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+/* Store a new device key */
+esp_err_t auth_set_key_hex(const char *hex)
+{
+    uint8_t key[AUTH_KEY_LEN];
+    nvs_handle_t nvsHandle;
+    esp_err_t err;
+
+    if (!auth_parse_hex(hex, key, sizeof(key)))
+        return ESP_ERR_INVALID_ARG;
+
+    err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+    if (err != ESP_OK)
+        return err;
+    err = nvs_set_blob(nvsHandle, "AUTH_KEY", key, sizeof(key));
+    if (err == ESP_OK)
+        err = nvs_commit(nvsHandle);
+    nvs_close(nvsHandle);
+    if (err != ESP_OK)
+        return err;
+
+    memcpy(auth_key, key, sizeof(auth_key));
+    auth_key_set = true;
+    return ESP_OK;
+}
+
+/* HMAC-SHA256, mbedtls uses the SHA accelerator */
+void auth_hmac(const void *data, size_t len, uint8_t mac[AUTH_MAC_LEN])
+{
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                    auth_key, sizeof(auth_key), data, len, mac);
+}
+
+bool auth_equal(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint8_t diff = 0;
+
+    for (size_t i = 0; i < len; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+auth_fresh_t auth_check_fresh(int64_t ts, uint64_t nonce)
+{
+    auth_fresh_t res = AUTH_FRESH;
+    int64_t const now = time(NULL);
+    auth_nonce_t *slot = NULL;
+    bool reserve = false;
+    int64_t floor;
+
+    if (ts <= 0)
+        return AUTH_STALE;
+
+    portENTER_CRITICAL(&auth_lock);
+    floor = (auth_time_synced ? now : auth_newest) - AUTH_WINDOW_S;
+    if ((ts < floor) || (ts <= auth_floor) || (auth_time_synced && (ts > now + AUTH_WINDOW_S))) {
+        res = AUTH_STALE;
+    } else {
+        /* Slots older than the window are free, their requests are stale anyway */
+        for (int i = 0; i < AUTH_NONCES; i++) {
+            if ((auth_nonces[i].ts == 0) || (auth_nonces[i].ts < floor)) {
+                if (slot == NULL)
+                    slot = &auth_nonces[i];
+            } else if (auth_nonces[i].nonce == nonce) {
+                res = AUTH_REPLAY;
+                break;
+            }
+        }
+        if ((res == AUTH_FRESH) && (slot == NULL))
+            res = AUTH_FULL;
+    }
+    if (res == AUTH_FRESH) {
+        slot->ts = ts;
+        slot->nonce = nonce;
+        if (ts > auth_newest)
+            auth_newest = ts;
+        reserve = (ts > auth_mark);
+    }
+    portEXIT_CRITICAL(&auth_lock);
+
+    // The nonce stays taken, a retry comes with a new one
+    if (reserve && (auth_mark_reserve(ts) != ESP_OK))
+        res = AUTH_ERROR;
+    return res;
+}
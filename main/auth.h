@@ -0,0 +1,56 @@
+/* Device key and message authentication
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef AUTH_H_
+#define AUTH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define AUTH_KEY_LEN        32
+#define AUTH_MAC_LEN        32
+
+/* Result of the replay check on a signed request */
+typedef enum
+{
+    AUTH_FRESH = 0,
+    AUTH_STALE,             // Timestamp outside the window
+    AUTH_REPLAY,            // Nonce already used inside the window
+    AUTH_FULL,              // Too many requests inside the window to remember
+    AUTH_ERROR,             // The replay mark could not be saved
+} auth_fresh_t;
+
+/* Load the device key (AUTH_KEY blob in NVS) and replay mark (AUTH_MARK) and start SNTP, call once the network is up */
+void auth_init(void);
+
+/* True once a device key has been provisioned */
+bool auth_enabled(void);
+
+/* Store a new device key given as hex, takes effect immediately */
+esp_err_t auth_set_key_hex(const char *hex);
+
+/* HMAC-SHA256 of data with the device key */
+void auth_hmac(const void *data, size_t len, uint8_t mac[AUTH_MAC_LEN]);
+
+/* Compare without leaking the position of the first difference */
+bool auth_equal(const uint8_t *a, const uint8_t *b, size_t len);
+
+/* Parse 2*len hex digits, false if the string is not exactly that */
+bool auth_parse_hex(const char *hex, uint8_t *out, size_t len);
+
+/* Accept each (timestamp, nonce) of an authentic request only once. With
+ * SNTP time the timestamp must be within WEBKEY_AUTH_WINDOW seconds of now,
+ * without it within the window of the newest request accepted since boot.
+ * Either way it must be past every request accepted before the last boot,
+ * which is kept as a mark in NVS. */
+auth_fresh_t auth_check_fresh(int64_t ts, uint64_t nonce);
+
+#endif /* AUTH_H_ */
@@ -7,3 +7,8 @@ COMPONENT_EMBED_FILES := www-data/favicon.ico
 COMPONENT_EMBED_FILES += www-data/index.html
 COMPONENT_EMBED_FILES += www-data/config.html
 
+ifdef CONFIG_WEBKEY_HTTPS
+COMPONENT_EMBED_TXTFILES := certs/servercert.pem
+COMPONENT_EMBED_TXTFILES += certs/prvtkey.pem
+endif
+
@@ -0,0 +1,75 @@
+/* Binary control protocol
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef CTRL_PROTO_H_
+#define CTRL_PROTO_H_
+
+#include <stdint.h>
+
+/* One fixed-size UDP datagram per request and per reply, little endian.
+ * The authenticator is HMAC-SHA256 over the first 16 bytes, truncated to
+ * 16 bytes, with the device key (AUTH_KEY in NVS). Replies are signed the
+ * same way. With no key set, the authenticator is ignored. */
+
+#define CTRL_MAGIC          0x4B57      // "WK"
+#define CTRL_VERSION        1
+#define CTRL_AUTH_LEN       16
+
+enum
+{
+  CTRL_CMD_PING = 0,                    // Status only
+  CTRL_CMD_CTRL,                        // Same as POST /ctrl
+  CTRL_CMD_ARM,                         // Same as POST /arm
+  CTRL_CMD_DISARM,                      // Same as POST /arm?key=off
+};
+
+enum
+{
+  CTRL_ST_OK = 0,
+  CTRL_ST_BUSY,
+  CTRL_ST_BAD_SELECTION,
+  CTRL_ST_AUTH,                         // Authenticator did not match
+  CTRL_ST_REPLAY,                       // Sequence number not newer than the last one, see floor
+  CTRL_ST_BAD_REQUEST,
+  CTRL_ST_ERROR,
+};
+
+typedef struct __attribute__((packed))
+{
+  uint16_t magic;
+  uint8_t  version;
+  uint8_t  cmd;                         // CTRL_CMD_*
+  uint32_t seq;                         // Must increase, echoed in the reply
+  uint8_t  button;                      // 1..4
+  uint8_t  mode;                        // SEQ_MODE_*
+  uint8_t  reserved[6];
+  uint8_t  auth[CTRL_AUTH_LEN];
+} ctrl_request_t;
+
+typedef struct __attribute__((packed))
+{
+  uint16_t magic;
+  uint8_t  version;
+  uint8_t  cmd;
+  uint32_t seq;
+  uint8_t  status;                      // CTRL_ST_*
+  uint8_t  busy;                        // Button being sent, 0 when idle
+  uint8_t  armed;                       // Armed button, 0 when none
+  uint32_t floor;                       // Requests must have a newer seq than this, kept across reboots
+  uint8_t  reserved[1];
+  uint8_t  auth[CTRL_AUTH_LEN];
+} ctrl_reply_t;
+
+_Static_assert(sizeof(ctrl_request_t) == 32, "ctrl_request_t must be 32 bytes");
+_Static_assert(sizeof(ctrl_reply_t) == 32, "ctrl_reply_t must be 32 bytes");
+
+/* Start the UDP control port */
+void ctrl_udp_init(void);
+
+#endif /* CTRL_PROTO_H_ */
@@ -0,0 +1,174 @@
+/* Binary UDP control port
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <esp_log.h>
+#include "nvs_flash.h"
+#include "lwip/sockets.h"
+
+#include "ctrl_proto.h"
+#include "hid_task.h"
+#include "auth.h"
+#include "trace.h"
+#include "audit.h"
+
+/* Should put these in .h file(s) */
+extern const char *TAG;
+
+#define CTRL_STACK_SIZE     3072
+#define CTRL_SEQ_BLOCK      0x10000     // Sequence numbers reserved per NVS write
+
+/* Last accepted sequence number, requests must be newer. The webkey reboots
+ * with the host, so a floor in RAM alone would let every captured datagram
+ * in again after a power cycle. NVS holds a mark a block ahead of it
+ * (CTRL_SEQ), which is where the floor restarts after a reboot, so it is
+ * only written once per block. */
+static uint32_t last_seq = 0;
+static uint32_t seq_mark = 0;
+
+/* Reserve sequence numbers up to 'mark' in NVS before any of them is used */
+static esp_err_t ctrl_seq_reserve(uint32_t mark)
+{
+    nvs_handle_t nvsHandle;
+    esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+
+    if (err != ESP_OK)
+        return err;
+    err = nvs_set_u32(nvsHandle, "CTRL_SEQ", mark);
+    if (err == ESP_OK)
+        err = nvs_commit(nvsHandle);
+    nvs_close(nvsHandle);
+    if (err == ESP_OK)
+        seq_mark = mark;
+    else
+        ESP_LOGE(TAG, "Error (%s) writing control sequence mark", esp_err_to_name(err));
+    return err;
+}
+
+/* Handle one request, fills in the reply status */
+static uint8_t ctrl_dispatch(const ctrl_request_t *req)
+{
+    uint8_t mac[AUTH_MAC_LEN];
+
+    if ((req->magic != CTRL_MAGIC) || (req->version != CTRL_VERSION))
+        return CTRL_ST_BAD_REQUEST;
+
+    if (auth_enabled()) {
+        auth_hmac(req, offsetof(ctrl_request_t, auth), mac);
+        if (!auth_equal(mac, req->auth, CTRL_AUTH_LEN))
+            return CTRL_ST_AUTH;
+        if ((int32_t)(req->seq - last_seq) <= 0)
+            return CTRL_ST_REPLAY;
+        if (((int32_t)(req->seq - seq_mark) > 0) && (ctrl_seq_reserve(req->seq + CTRL_SEQ_BLOCK) != ESP_OK))
+            return CTRL_ST_ERROR;
+        last_seq = req->seq;
+    }
+
+    switch (req->cmd) {
+    case CTRL_CMD_PING:
+        return CTRL_ST_OK;
+    case CTRL_CMD_CTRL:
+        switch (hid_command(req->button, req->mode)) {
+        case HID_CMD_OK:
+            return CTRL_ST_OK;
+        case HID_CMD_BUSY:
+            return CTRL_ST_BUSY;
+        default:
+            return CTRL_ST_BAD_SELECTION;
+        }
+    case CTRL_CMD_ARM:
+        if ((req->button < 1) || (req->button > HID_NUM_BUTTONS) || (req->mode > SEQ_MODE_LED))
+            return CTRL_ST_BAD_SELECTION;
+        return (hid_arm(req->button, req->mode) == ESP_OK) ? CTRL_ST_OK : CTRL_ST_ERROR;
+    case CTRL_CMD_DISARM:
+        return (hid_arm(0, SEQ_MODE_BLIND) == ESP_OK) ? CTRL_ST_OK : CTRL_ST_ERROR;
+    default:
+        return CTRL_ST_BAD_REQUEST;
+    }
+}
+
+static void ctrl_udp_task(void *param)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_WEBKEY_CTRL_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    struct sockaddr_storage from;
+    socklen_t from_len;
+    ctrl_request_t req;
+    ctrl_reply_t reply;
+    uint8_t mac[AUTH_MAC_LEN];
+    int sock, len;
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if ((sock < 0) || (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)) {
+        ESP_LOGE(TAG, "Unable to open control port %d", CONFIG_WEBKEY_CTRL_PORT);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Control port on UDP %d", CONFIG_WEBKEY_CTRL_PORT);
+
+    while (1) {
+        from_len = sizeof(from);
+        len = recvfrom(sock, &req, sizeof(req), 0, (struct sockaddr *) &from, &from_len);
+        if (len != sizeof(req))
+            continue;   // Not ours, don't answer
+
+        memset(&reply, 0, sizeof(reply));
+        reply.magic = CTRL_MAGIC;
+        reply.version = CTRL_VERSION;
+        reply.cmd = req.cmd;
+        reply.seq = req.seq;
+        reply.status = ctrl_dispatch(&req);
+        reply.busy = hid_busy();
+        reply.armed = hid_armed();
+        reply.floor = last_seq;
+        if (auth_enabled()) {
+            auth_hmac(&reply, offsetof(ctrl_reply_t, auth), mac);
+            memcpy(reply.auth, mac, CTRL_AUTH_LEN);
+        }
+        trace(TRACE_CTRL_UDP, req.cmd, reply.status, req.seq);
+        if ((req.cmd == CTRL_CMD_CTRL) || (req.cmd == CTRL_CMD_ARM) || (req.cmd == CTRL_CMD_DISARM)) {
+            static const uint8_t types[] = {
+                [CTRL_CMD_CTRL] = AUDIT_CTRL, [CTRL_CMD_ARM] = AUDIT_ARM, [CTRL_CMD_DISARM] = AUDIT_DISARM,
+            };
+            audit_append(&(audit_record_t) {
+                .type = types[req.cmd],
+                .source = AUDIT_SRC_UDP,
+                .addr = ((struct sockaddr_in *) &from)->sin_addr.s_addr,
+                .btn = req.button,
+                .mode = req.mode,
+                .result = reply.status,
+                .flags = (auth_enabled() && (reply.status != CTRL_ST_AUTH) &&
+                          (reply.status != CTRL_ST_REPLAY)) ? AUDIT_F_SIGNED : 0,
+            });
+        }
+        sendto(sock, &reply, sizeof(reply), 0, (struct sockaddr *) &from, from_len);
+    }
+}
+
+void ctrl_udp_init(void)
+{
+    nvs_handle_t nvsHandle;
+
+    if (CONFIG_WEBKEY_CTRL_PORT == 0)
+        return;
+
+    /* Anything up to the mark may have been used before the reboot */
+    if (nvs_open("storage", NVS_READONLY, &nvsHandle) == ESP_OK) {
+        if (nvs_get_u32(nvsHandle, "CTRL_SEQ", &seq_mark) == ESP_OK)
+            last_seq = seq_mark;
+        nvs_close(nvsHandle);
+    }
+    xTaskCreate(ctrl_udp_task, "ctrl_udp", CTRL_STACK_SIZE, NULL, 5, NULL);
+}
@@ -0,0 +1,125 @@
+/* Keyboard report scheduler
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+
+#include "hid_sched.h"
+
+static const uint8_t no_keys[HID_SCHED_KEYS] = { 0 };
+
+/* Send a report unless the host already has it */
+static int sched_send(hid_sched_t *s, uint8_t modifier, const uint8_t keycode[HID_SCHED_KEYS])
+{
+    int res;
+
+    if ((modifier == s->modifier) && (memcmp(keycode, s->keycode, HID_SCHED_KEYS) == 0))
+        return 0;
+    if ((res = s->send(s->ctx, modifier, keycode)) != 0)
+        return res;
+    s->modifier = modifier;
+    memcpy(s->keycode, keycode, HID_SCHED_KEYS);
+    s->reports++;
+    return 0;
+}
+
+static bool sched_down(const uint8_t keycode[HID_SCHED_KEYS], uint8_t key)
+{
+    return memchr(keycode, key, HID_SCHED_KEYS) != NULL;
+}
+
+void hid_sched_init(hid_sched_t *s, hid_sched_send_fn send, hid_sched_delay_fn delay, void *ctx)
+{
+    memset(s, 0, sizeof(*s));
+    s->send = send;
+    s->delay = delay;
+    s->ctx = ctx;
+}
+
+int hid_sched_press(hid_sched_t *s, uint8_t modifier, const uint8_t *keys, size_t count)
+{
+    uint8_t keycode[HID_SCHED_KEYS] = { 0 };
+    bool repeat = false;
+    size_t n = 0;
+    int res;
+
+    for (size_t i = 0; (i < count) && (n < HID_SCHED_KEYS); i++) {
+        if ((keys[i] == 0) || sched_down(keycode, keys[i]))
+            continue;
+        repeat |= sched_down(s->keycode, keys[i]);
+        keycode[n++] = keys[i];
+    }
+
+    // A key still down only registers again once the host has seen it go up,
+    // the new modifiers can go with that release
+    if (repeat && ((res = sched_send(s, modifier, no_keys)) != 0))
+        return res;
+    s->release = false;
+    return sched_send(s, modifier, keycode);
+}
+
+void hid_sched_release(hid_sched_t *s)
+{
+    s->release = true;
+}
+
+int hid_sched_wait(hid_sched_t *s, uint32_t ms)
+{
+    int res;
+
+    if ((ms > HID_SCHED_HOLD_MAX_MS) && ((res = hid_sched_flush(s)) != 0))
+        return res;
+    return ms ? s->delay(s->ctx, ms) : 0;
+}
+
+int hid_sched_flush(hid_sched_t *s)
+{
+    int res;
+
+    if (!s->release)
+        return 0;
+    if ((res = sched_send(s, 0, no_keys)) != 0)
+        return res;
+    s->release = false;
+    return 0;
+}
+
+int hid_sched_repeat(hid_sched_t *s, uint8_t key, uint32_t count, uint32_t hold_ms, uint32_t gap_ms)
+{
+    int res;
+
+    for ( ; count != 0; count--) {
+        if ((res = hid_sched_press(s, 0, &key, 1)) != 0)
+            return res;
+        if ((res = hid_sched_wait(s, hold_ms)) != 0)
+            return res;
+        hid_sched_release(s);
+        if ((res = hid_sched_wait(s, gap_ms)) != 0)
+            return res;
+    }
+    return 0;
+}
+
+int hid_sched_play(hid_sched_t *s, const hid_sched_step_t *steps, size_t count, uint32_t gap_ms)
+{
+    int res;
+
+    for ( ; count != 0; count--, steps++) {
+        uint32_t delay = steps->delay_ms;
+        if ((steps->modifier == 0) && (steps->key == 0)) {
+            hid_sched_release(s);
+            delay += gap_ms;
+        } else if ((res = hid_sched_press(s, steps->modifier, &steps->key, 1)) != 0) {
+            return res;
+        }
+        if ((res = hid_sched_wait(s, delay)) != 0)
+            return res;
+    }
+    hid_sched_release(s);
+    return hid_sched_flush(s);
+}
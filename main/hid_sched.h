@@ -0,0 +1,75 @@
+/* Keyboard report scheduler
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef HID_SCHED_H_
+#define HID_SCHED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Turns presses and releases into as few keyboard reports as the host can
+ * still read in order. The keys of one press go down together in a single
+ * report, and that report also lifts whatever was down before, so a release
+ * is only sent on its own when a key has to go up before it goes down again,
+ * or before a wait long enough for the host to start repeating the key.
+ * Modifier changes ride along with the keys. Reports and delays go through
+ * callbacks, there is nothing here that needs the device. */
+
+#define HID_SCHED_KEYS          6       // Boot keyboard rollover
+#define HID_SCHED_HOLD_MAX_MS   200     // Longest a key is left down, under any typematic delay
+
+/* One keyboard report and the time to hold it, as macros are stored. A
+ * release (no key, no modifier) is followed by the mode's key gap as well. */
+typedef struct __attribute__((packed))
+{
+    uint8_t modifier;
+    uint8_t key;
+    uint16_t delay_ms;
+} hid_sched_step_t;
+
+/* Both return 0 to carry on, anything else is handed back to the caller */
+typedef int (*hid_sched_send_fn)(void *ctx, uint8_t modifier, const uint8_t keycode[HID_SCHED_KEYS]);
+typedef int (*hid_sched_delay_fn)(void *ctx, uint32_t ms);
+
+typedef struct
+{
+    hid_sched_send_fn send;
+    hid_sched_delay_fn delay;
+    void *ctx;
+    uint8_t modifier;                   // As last sent
+    uint8_t keycode[HID_SCHED_KEYS];    // As last sent, 0 in unused slots
+    bool release;                       // Release asked for but not sent yet
+    uint32_t reports;                   // Reports sent
+} hid_sched_t;
+
+/* Start with nothing down */
+void hid_sched_init(hid_sched_t *s, hid_sched_send_fn send, hid_sched_delay_fn delay, void *ctx);
+
+/* Press 'count' keys (0 and duplicates ignored, at most HID_SCHED_KEYS) with
+ * 'modifier' at once. The host may see keys of one press in any order, so
+ * text goes one key per press. */
+int hid_sched_press(hid_sched_t *s, uint8_t modifier, const uint8_t *keys, size_t count);
+
+/* Release everything, sent with the next press or wait that needs it */
+void hid_sched_release(hid_sched_t *s);
+
+/* Let 'ms' pass, sending an owed release first if the wait is long */
+int hid_sched_wait(hid_sched_t *s, uint32_t ms);
+
+/* Send an owed release now, at the end of a sequence */
+int hid_sched_flush(hid_sched_t *s);
+
+/* Tap 'key' 'count' times, each held 'hold_ms' and followed by 'gap_ms' */
+int hid_sched_repeat(hid_sched_t *s, uint8_t key, uint32_t count, uint32_t hold_ms, uint32_t gap_ms);
+
+/* Play 'count' steps and release everything at the end */
+int hid_sched_play(hid_sched_t *s, const hid_sched_step_t *steps, size_t count, uint32_t gap_ms);
+
+#endif /* HID_SCHED_H_ */
@@ -0,0 +1,810 @@
+/* HID key sequence engine
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+#include "tusb.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+
+#include "usb_descriptors.h"
+#include "hid_task.h"
+#include "macro.h"
+#include "keymap.h"
+#include "hid_sched.h"
+#include "leadin.h"
+#include "usb_net.h"
+#include "trace.h"
+#include "audit.h"
+#include "wifi_ps.h"
+
+extern const char *TAG;
+
+//--------------------------------------------------------------------+
+// MACRO CONSTANT TYPEDEF PROTYPES
+//--------------------------------------------------------------------+
+
+// static task for hid, it writes NVS (arming, lead-in history) and the
+// audit log and logs 64-bit values, which 2*configMINIMAL_STACK_SIZE can't hold
+#define HID_STACK_SIZE      4096
+static StackType_t  hid_stack[HID_STACK_SIZE];
+static StaticTask_t hid_taskdef;
+
+// static queue of bus and web events
+#define HID_QUEUE_LEN       16
+static uint8_t       hid_queue_storage[HID_QUEUE_LEN * sizeof(hid_event_t)];
+static StaticQueue_t hid_queue_def;
+static QueueHandle_t hid_queue;
+static uint32_t      hid_queue_dropped = 0;
+
+// Recent events kept for diagnostics
+#define HID_HISTORY_LEN     32
+static hid_event_t  hid_history[HID_HISTORY_LEN];
+static uint32_t     hid_history_count = 0;
+static portMUX_TYPE hid_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define BLIND_KEY_GAP_MS    500       // Delay between keys in blind mode
+#define LED_KEY_GAP_MS      20        // Delay between keys once host is listening
+#define KEY_HOLD_MS         10        // Time a key is held down
+#define LEADIN_SAVE_IDLE_MS 5000      // Quiet bus before lead-in history goes to flash
+#define HID_WAIT_MS         60000     // Give up if host is not listening by then
+#define CONTROL_WAIT_MS     5000      // System/consumer control needs a host that is up or can be woken
+
+typedef enum
+{
+  SEQ_OK = 0,
+  SEQ_RESTART,          // Host re-enumerated us, start over
+  SEQ_TIMEOUT,
+  SEQ_ABORTED,          // Host reset part way through typed text, not retried
+} seq_result_t;
+
+static const char * const seq_result_names[] =
+{
+  "ok", "restart", "timeout", "aborted"
+};
+
+static const char * const hid_event_names[] =
+{
+  "none", "mount", "umount", "suspend", "resume", "leds", "command", "protocol"
+};
+
+// Command from web, cleared when the sequence completes
+static volatile uint32_t button_pressed = 0;
+static volatile uint32_t button_mode = SEQ_MODE_BLIND;
+static volatile int64_t  button_time = 0;
+
+// Text to type, only touched by the HID task while button_pressed is HID_BTN_TYPE
+static char     type_text[HID_TYPE_MAX];
+static size_t   type_len = 0;
+static uint32_t type_gap_ms = 0;
+
+// Last typed text, for /status
+static uint32_t type_chars = 0;
+static uint32_t type_reports = 0;
+static int64_t  type_us = 0;
+static uint8_t  type_layout = KEYMAP_US;
+static int      type_result = -1;     // seq_result_t, -1 before the first text
+
+// Reports the last key sequence took, for /status
+static uint32_t seq_reports = 0;
+
+// Selection to fire on the next enumeration, persisted in NVS
+static volatile uint32_t armed_button = 0;
+static volatile uint32_t armed_mode = SEQ_MODE_BLIND;
+
+// Bus state, only written by the HID task
+static volatile bool     usb_mounted = false;
+static volatile bool     usb_suspended = false;
+static volatile bool     usb_wakeup_allowed = false;
+static bool              usb_wakeup_sent = false;
+static int64_t           usb_mount_time = 0;    // us, last enumeration
+
+// Keyboard LED state as last set by the host. BIOS/UEFI and GRUB set
+// NumLock/CapsLock once they start reading the keyboard, so an LED
+// report tells us the host is actually listening.
+static volatile uint8_t  led_state = 0;
+static volatile uint32_t led_reports = 0;
+static volatile int64_t  led_report_time = 0;   // us, last LED report
+static volatile int64_t  led_change_time = 0;   // us, last LED state change
+
+// Keyboard protocol selected by the host, BIOS uses boot protocol
+static volatile uint8_t  kbd_protocol = 1;
+
+void hid_task(void* param);
+
+//--------------------------------------------------------------------+
+// Events
+//--------------------------------------------------------------------+
+
+// Queue an event, never blocks so it is safe from the USB task. Returns
+// false if the queue was full and the event is lost.
+static bool hid_post(uint8_t type, uint8_t arg)
+{
+  hid_event_t const ev = { .time = esp_timer_get_time(), .type = type, .arg = arg };
+
+  trace(TRACE_HID_EVENT, type, arg, 0);
+  if ( xQueueSend(hid_queue, &ev, 0) != pdTRUE ) {
+    hid_queue_dropped++;
+    return false;
+  }
+  return true;
+}
+
+// Queue the event for a claimed command. If it is lost the task never runs
+// the command, so give up the claim rather than stay busy for good.
+static bool hid_post_command(uint32_t btn)
+{
+  if ( hid_post(HID_EV_COMMAND, btn) ) {
+    return true;
+  }
+  portENTER_CRITICAL(&hid_lock);
+  if ( button_pressed == btn ) {
+    button_pressed = 0;
+  }
+  portEXIT_CRITICAL(&hid_lock);
+  return false;
+}
+
+// Wait up to 'ms' for the next event and apply it to the bus state
+static hid_event_type_t hid_wait_event(int64_t ms)
+{
+  hid_event_t ev;
+  TickType_t ticks = portMAX_DELAY;
+
+  if ( ms >= 0 ) {
+    ticks = pdMS_TO_TICKS(ms);
+    if ( (ticks == 0) && (ms > 0) ) ticks = 1;
+  }
+  if ( xQueueReceive(hid_queue, &ev, ticks) != pdTRUE ) {
+    return HID_EV_NONE;
+  }
+
+  portENTER_CRITICAL(&hid_lock);
+  hid_history[hid_history_count % HID_HISTORY_LEN] = ev;
+  hid_history_count++;
+  portEXIT_CRITICAL(&hid_lock);
+  leadin_event(&ev);
+
+  switch ( ev.type ) {
+    case HID_EV_MOUNT:
+      usb_mounted = true;
+      usb_suspended = false;
+      usb_mount_time = ev.time;
+      break;
+    case HID_EV_UMOUNT:
+      usb_mounted = false;
+      usb_suspended = false;
+      break;
+    case HID_EV_SUSPEND:
+      usb_suspended = true;
+      usb_wakeup_allowed = ev.arg;
+      usb_wakeup_sent = false;
+      break;
+    case HID_EV_RESUME:
+      usb_suspended = false;
+      break;
+    case HID_EV_LEDS:
+      if ( ev.arg != led_state ) {
+        led_state = ev.arg;
+        led_change_time = ev.time;
+      }
+      led_report_time = ev.time;
+      led_reports++;
+      break;
+    case HID_EV_PROTOCOL:
+      kbd_protocol = ev.arg;
+      break;
+    default:
+      break;
+  }
+  return ev.type;
+}
+
+// Host is enumerated and awake
+static bool host_ready(void)
+{
+  if ( usb_suspended && usb_wakeup_allowed && !usb_wakeup_sent ) {
+    // Wake up host if we are in suspend mode
+    // and REMOTE_WAKEUP feature is enabled by host
+    tud_remote_wakeup();
+    usb_wakeup_sent = true;
+  }
+  return usb_mounted && !usb_suspended;
+}
+
+//--------------------------------------------------------------------+
+// Key sequence
+//--------------------------------------------------------------------+
+
+// Sleep for 'ms' while tracking bus events. A (re-)enumeration means the
+// host was reset and the sequence has to start over, a suspend pauses it
+// until the host is back or the deadline passes.
+static seq_result_t hid_delay(uint32_t ms, int64_t deadline)
+{
+  int64_t const until = esp_timer_get_time() + (int64_t) ms * 1000;
+
+  while ( 1 ) {
+    int64_t const now = esp_timer_get_time();
+    int64_t wait;
+
+    if ( host_ready() ) {
+      if ( now >= until ) return SEQ_OK;
+      wait = until - now;
+    } else {
+      if ( now >= deadline ) return SEQ_TIMEOUT;
+      wait = deadline - now;
+    }
+
+    hid_event_type_t const type = hid_wait_event((wait + 999) / 1000);
+    if ( (type == HID_EV_MOUNT) || (type == HID_EV_UMOUNT) ) {
+      return SEQ_RESTART;
+    }
+  }
+}
+
+// Send a report with the keys in keycode and modifiers down
+static seq_result_t hid_send_keys(uint8_t modifier, const uint8_t keycode[HID_SCHED_KEYS], int64_t deadline)
+{
+  seq_result_t res;
+
+  while ( !tud_hid_n_ready(ITF_NUM_KEYBOARD) ) {
+    if ( (res = hid_delay(1, deadline)) != SEQ_OK ) return res;
+  }
+
+  // Boot keyboard has no report ID, the same report works in either protocol
+  trace(TRACE_HID_REPORT, modifier, keycode[0], keycode[1]);
+  tud_hid_n_keyboard_report(ITF_NUM_KEYBOARD, 0, modifier, keycode);
+  return SEQ_OK;
+}
+
+// Scheduler callbacks, ctx is the sequence deadline
+static int sched_send(void *ctx, uint8_t modifier, const uint8_t keycode[HID_SCHED_KEYS])
+{
+  return hid_send_keys(modifier, keycode, *(int64_t const *) ctx);
+}
+
+static int sched_delay(void *ctx, uint32_t ms)
+{
+  return hid_delay(ms, *(int64_t const *) ctx);
+}
+
+#if CONFIG_WEBKEY_USB_CONTROL
+// Press and release a System Control or Consumer Control usage. The
+// host acts on the press, the release (usage 0) re-arms it.
+static seq_result_t hid_send_control(uint8_t report_id, uint16_t usage, int64_t deadline)
+{
+  seq_result_t res;
+
+  for ( int down = 1; down >= 0; down-- ) {
+    uint16_t const value = down ? usage : 0;
+
+    while ( !tud_hid_n_ready(ITF_NUM_CONTROL) ) {
+      if ( (res = hid_delay(1, deadline)) != SEQ_OK ) return res;
+    }
+    trace(TRACE_HID_CONTROL, report_id, value, 0);
+    if ( report_id == REPORT_ID_SYSTEM_CONTROL ) {
+      uint8_t const code = value;
+      tud_hid_n_report(ITF_NUM_CONTROL, report_id, &code, sizeof(code));
+    } else {
+      tud_hid_n_report(ITF_NUM_CONTROL, report_id, &value, sizeof(value));
+    }
+    if ( down && (res = hid_delay(KEY_HOLD_MS, deadline)) != SEQ_OK ) return res;
+  }
+  return SEQ_OK;
+}
+#endif
+
+// Wait for the host to write the keyboard LEDs, unless it already has
+// since it last enumerated us (the request came once the menu was up)
+static seq_result_t hid_wait_leds(int64_t deadline)
+{
+  uint32_t const reports = led_reports;
+  int64_t const since = esp_timer_get_time();
+
+  if ( usb_mounted && (reports != 0) && (led_report_time >= usb_mount_time) ) {
+    ESP_LOGI(TAG, "LED handshake %lld ms ago (leds=0x%02x)", (since - led_report_time) / 1000, led_state);
+    return SEQ_OK;
+  }
+  while ( led_reports == reports ) {
+    int64_t const now = esp_timer_get_time();
+    if ( now >= deadline ) return SEQ_TIMEOUT;
+    (void) host_ready();
+    hid_wait_event((deadline - now + 999) / 1000);
+  }
+  ESP_LOGI(TAG, "LED handshake after %lld ms (leds=0x%02x)", (led_report_time - since) / 1000, led_state);
+  return SEQ_OK;
+}
+
+// Send key sequence
+//     spaces over the window past boots started reading keys in, up to 30 (halts grub autoboot)
+//     the button's macro, by default n-1 down arrows and ENTER
+static seq_result_t hid_send_sequence(uint32_t btn, uint32_t mode, int64_t deadline)
+{
+  uint32_t lead_in;
+  uint32_t key_gap = BLIND_KEY_GAP_MS;
+  const macro_step_t *step;
+  uint32_t count = macro_get(btn, &step);
+  seq_result_t res;
+
+  // Once the host has set its LEDs it is reading keys, so a
+  // single space is enough to halt autoboot
+  if ( mode == SEQ_MODE_LED ) {
+    if ( (res = hid_wait_leds(deadline)) != SEQ_OK ) return res;
+    lead_in = 1;
+    key_gap = LED_KEY_GAP_MS;
+  } else {
+    leadin_plan_t plan;
+    leadin_plan(key_gap, &plan);
+    if ( plan.learned ) {
+      ESP_LOGI(TAG, "Lead-in of %u after %u ms", plan.count, plan.wait_ms);
+    }
+    if ( (res = hid_delay(plan.wait_ms, deadline)) != SEQ_OK ) return res;
+    lead_in = plan.count;
+  }
+
+  // Releases are left to the scheduler, which folds them into the next
+  // key unless that key repeats or the gap is long enough to autorepeat.
+  // Reports were compiled when the macro was saved, just play them.
+  hid_sched_t sched;
+  hid_sched_init(&sched, sched_send, sched_delay, &deadline);
+  res = hid_sched_repeat(&sched, HID_KEY_SPACE, lead_in, KEY_HOLD_MS, key_gap);
+  if ( res == SEQ_OK ) {
+    res = hid_sched_play(&sched, step, count, key_gap);
+  }
+  seq_reports = sched.reports;
+  return res;
+}
+
+// Type the queued text as fast as the host takes reports. One key per
+// press keeps the order, and the scheduler only releases a key before it
+// is pressed again and at the end, so most characters cost a single report.
+static seq_result_t hid_type_text(uint32_t layout, int64_t deadline)
+{
+  int64_t const start = esp_timer_get_time();
+  uint8_t const space = HID_KEY_SPACE;
+  hid_sched_t sched;
+  seq_result_t res = SEQ_OK;
+
+  hid_sched_init(&sched, sched_send, sched_delay, &deadline);
+  type_chars = 0;
+  type_layout = layout;
+  for ( size_t i = 0; (i < type_len) && (res == SEQ_OK); i++ ) {
+    const keymap_key_t *k = keymap_lookup(layout, type_text[i]);
+    if ( k == NULL ) continue;    // Checked by hid_type
+
+    if ( (res = hid_sched_press(&sched, k->modifier, &k->key, 1)) != SEQ_OK ) break;
+
+    // A dead key only gives its own character when space follows
+    if ( (k->flags & KEYMAP_F_DEAD) && (res = hid_sched_press(&sched, 0, &space, 1)) != SEQ_OK ) break;
+    type_chars++;
+    res = hid_sched_wait(&sched, type_gap_ms);
+  }
+  if ( res == SEQ_OK ) {
+    hid_sched_release(&sched);
+    res = hid_sched_flush(&sched);
+  }
+  type_reports = sched.reports;
+
+  // Whatever the host was showing is gone, the rest must not go to the next screen
+  if ( res == SEQ_RESTART ) res = SEQ_ABORTED;
+  type_us = esp_timer_get_time() - start;
+  type_result = res;
+  ESP_LOGI(TAG, "Typed %u chars in %u reports, %lld ms", type_chars, type_reports, type_us / 1000);
+  return res;
+}
+
+// Run one attempt of whatever the command is
+static seq_result_t hid_run_once(uint32_t btn, uint32_t mode, int64_t deadline)
+{
+  switch ( btn ) {
+    case HID_BTN_TYPE:
+      return hid_type_text(mode, deadline);
+#if CONFIG_WEBKEY_USB_CONTROL
+    case HID_BTN_SYSTEM:
+      return hid_send_control(REPORT_ID_SYSTEM_CONTROL, mode, deadline);
+    case HID_BTN_CONSUMER:
+      return hid_send_control(REPORT_ID_CONSUMER_CONTROL, mode, deadline);
+#endif
+    default:
+      return hid_send_sequence(btn, mode, deadline);
+  }
+}
+
+static seq_result_t hid_run_command(uint32_t btn, uint32_t mode, int64_t submitted)
+{
+  uint32_t const wait_ms = ((btn == HID_BTN_SYSTEM) || (btn == HID_BTN_CONSUMER)) ? CONTROL_WAIT_MS : HID_WAIT_MS;
+  int64_t deadline = submitted + (int64_t) wait_ms * 1000;
+  seq_result_t res;
+
+  trace(TRACE_HID_SEQ_START, btn, mode, 0);
+  wifi_ps_hold(true);
+#if CONFIG_WEBKEY_USB_CONTROL
+  // Asked to wake the host, so signal resume even if an earlier attempt was ignored
+  if ( (btn == HID_BTN_SYSTEM) && (mode == HID_POWER_WAKE) ) {
+    usb_wakeup_sent = false;
+  }
+#endif
+  do {
+    // Wait for the host to enumerate us and be awake
+    res = hid_delay(0, deadline);
+    if ( res == SEQ_OK ) {
+      res = hid_run_once(btn, mode, deadline);
+    }
+    if ( res == SEQ_RESTART ) {
+      ESP_LOGI(TAG, "Host re-enumerated, restarting sequence");
+      deadline = esp_timer_get_time() + (int64_t) wait_ms * 1000;
+    }
+  } while ( res == SEQ_RESTART );
+
+  if ( res == SEQ_TIMEOUT ) {
+    ESP_LOGI(TAG, "Timeout before sequence ended");
+  } else if ( res == SEQ_ABORTED ) {
+    ESP_LOGI(TAG, "Host reset while typing");
+  } else {
+    ESP_LOGI(TAG, "Sequence b%u done after %lld ms", btn, (esp_timer_get_time() - submitted) / 1000);
+  }
+  trace(TRACE_HID_SEQ_END, btn, res, (esp_timer_get_time() - submitted) / 1000);
+  wifi_ps_hold(false);
+  return res;
+}
+
+// Take the armed selection as the current command if idle
+static bool hid_claim_armed(int64_t mounted)
+{
+  bool claimed = false;
+
+  portENTER_CRITICAL(&hid_lock);
+  if ( (button_pressed == 0) && (armed_button != 0) ) {
+    button_mode = armed_mode;
+    button_time = mounted;
+    button_pressed = armed_button;
+    claimed = true;
+  }
+  portEXIT_CRITICAL(&hid_lock);
+  return claimed;
+}
+
+void hid_task(void* param)
+{
+  (void) param;
+
+  while(1)
+  {
+    // Wait for command from web, tracking bus state meanwhile. An armed
+    // selection fires on the first enumeration after the host powers up
+    // or resets, which is the earliest the firmware can see keys.
+    // New lead-in history waits for a quiet bus, a flash write stalls the
+    // caches and must not land between enumeration and the keys
+    bool armed = false;
+    hid_event_type_t const type = hid_wait_event(leadin_pending() ? LEADIN_SAVE_IDLE_MS : -1);
+    if ( type == HID_EV_NONE ) {
+      leadin_save();
+      continue;
+    }
+    if ( type == HID_EV_MOUNT ) {
+      armed = hid_claim_armed(esp_timer_get_time());
+      if ( !armed ) continue;
+      ESP_LOGI(TAG, "Host enumerated, firing armed selection b%u", button_pressed);
+    } else if ( type != HID_EV_COMMAND ) {
+      continue;
+    }
+
+    // Record command so user can't change it mid-stream
+    uint32_t const btn = button_pressed;
+    uint32_t const mode = button_mode;
+    if ( btn == 0 ) continue;
+
+    // Armed selection stays armed until it has been delivered
+    seq_result_t const res = hid_run_command(btn, mode, button_time);
+    audit_append(&(audit_record_t) {
+      .type = AUDIT_SEQ_END,
+      .source = armed ? AUDIT_SRC_ARMED : AUDIT_SRC_DEVICE,
+      .btn = btn,
+      .mode = mode,
+      .result = res,
+      .arg = (esp_timer_get_time() - button_time) / 1000,
+    });
+    if ( (res == SEQ_OK) && armed ) {
+      hid_arm(0, SEQ_MODE_BLIND);
+    }
+
+    // Clear command and discard any that occurred during execution
+    button_pressed = 0;
+  }
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+void hid_init(void)
+{
+  nvs_handle_t nvsHandle;
+  uint8_t val;
+
+  // Restore armed selection, it survives a reset of the webkey itself
+  if ( nvs_open("storage", NVS_READONLY, &nvsHandle) == ESP_OK ) {
+    if ( nvs_get_u8(nvsHandle, "ARM_BTN", &val) == ESP_OK ) {
+      armed_button = val;
+    }
+    if ( nvs_get_u8(nvsHandle, "ARM_MODE", &val) == ESP_OK ) {
+      armed_mode = val;
+    }
+    nvs_close(nvsHandle);
+    if ( armed_button ) {
+      ESP_LOGI(TAG, "Selection b%u armed", armed_button);
+    }
+  }
+
+  macro_init();
+  leadin_init();
+
+  hid_queue = xQueueCreateStatic(HID_QUEUE_LEN, sizeof(hid_event_t), hid_queue_storage, &hid_queue_def);
+
+  // Create HID task
+  (void) xTaskCreateStatic( hid_task, "hid", HID_STACK_SIZE, NULL, configMAX_PRIORITIES-2, hid_stack, &hid_taskdef);
+}
+
+bool hid_submit(uint32_t btn, uint32_t mode)
+{
+  bool accepted = false;
+
+  portENTER_CRITICAL(&hid_lock);
+  if ( button_pressed == 0 ) {
+    button_mode = mode;
+    button_time = esp_timer_get_time();
+    button_pressed = btn;
+    accepted = true;
+  }
+  portEXIT_CRITICAL(&hid_lock);
+
+  return accepted && hid_post_command(btn);
+}
+
+hid_cmd_result_t hid_command(uint32_t btn, uint32_t mode)
+{
+  if ( button_pressed != 0 ) {
+    return HID_CMD_BUSY;
+  }
+  if ( (btn < 1) || (btn > HID_NUM_BUTTONS) || (mode > SEQ_MODE_LED) ) {
+    return HID_CMD_BAD_SELECTION;
+  }
+  const macro_step_t *steps;
+  if ( macro_get(btn, &steps) == 0 ) {
+    return HID_CMD_BAD_SELECTION;
+  }
+  return hid_submit(btn, mode) ? HID_CMD_OK : HID_CMD_BUSY;
+}
+
+hid_cmd_result_t hid_type(const char *text, size_t len, uint32_t layout, uint32_t gap_ms)
+{
+  bool accepted = false;
+
+  if ( button_pressed != 0 ) {
+    return HID_CMD_BUSY;
+  }
+  if ( (len == 0) || (len > HID_TYPE_MAX) ) {
+    return HID_CMD_BAD_SELECTION;
+  }
+  for ( size_t i = 0; i < len; i++ ) {
+    if ( keymap_lookup(layout, text[i]) == NULL ) return HID_CMD_BAD_SELECTION;
+  }
+
+  // Claim the engine first, the task reads the text once the event arrives
+  portENTER_CRITICAL(&hid_lock);
+  if ( button_pressed == 0 ) {
+    button_mode = layout;
+    button_time = esp_timer_get_time();
+    button_pressed = HID_BTN_TYPE;
+    accepted = true;
+  }
+  portEXIT_CRITICAL(&hid_lock);
+  if ( !accepted ) {
+    return HID_CMD_BUSY;
+  }
+
+  memcpy(type_text, text, len);
+  type_len = len;
+  type_gap_ms = gap_ms;
+  return hid_post_command(HID_BTN_TYPE) ? HID_CMD_OK : HID_CMD_BUSY;
+}
+
+hid_cmd_result_t hid_power(uint32_t action)
+{
+#if CONFIG_WEBKEY_USB_CONTROL
+  if ( button_pressed != 0 ) {
+    return HID_CMD_BUSY;
+  }
+  if ( (action < HID_POWER_OFF) || (action > HID_POWER_WAKE) ) {
+    return HID_CMD_BAD_SELECTION;
+  }
+  // Only a wake up can get through to a suspended host, and only if it allows it
+  if ( usb_suspended && ((action != HID_POWER_WAKE) || !usb_wakeup_allowed) ) {
+    return HID_CMD_BAD_SELECTION;
+  }
+  return hid_submit(HID_BTN_SYSTEM, action) ? HID_CMD_OK : HID_CMD_BUSY;
+#else
+  (void) action;
+  return HID_CMD_BAD_SELECTION;
+#endif
+}
+
+hid_cmd_result_t hid_consumer(uint32_t usage)
+{
+#if CONFIG_WEBKEY_USB_CONTROL
+  if ( button_pressed != 0 ) {
+    return HID_CMD_BUSY;
+  }
+  // Logical range of TUD_HID_REPORT_DESC_CONSUMER
+  if ( (usage == 0) || (usage > 0x3FF) || usb_suspended ) {
+    return HID_CMD_BAD_SELECTION;
+  }
+  return hid_submit(HID_BTN_CONSUMER, usage) ? HID_CMD_OK : HID_CMD_BUSY;
+#else
+  (void) usage;
+  return HID_CMD_BAD_SELECTION;
+#endif
+}
+
+esp_err_t hid_arm(uint32_t btn, uint32_t mode)
+{
+  nvs_handle_t nvsHandle;
+  esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+  if ( err != ESP_OK ) {
+    ESP_LOGI(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+    return err;
+  }
+
+  if ( btn ) {
+    err = nvs_set_u8(nvsHandle, "ARM_BTN", btn);
+    if ( err == ESP_OK ) err = nvs_set_u8(nvsHandle, "ARM_MODE", mode);
+  } else {
+    err = nvs_erase_key(nvsHandle, "ARM_BTN");
+    if ( err == ESP_ERR_NVS_NOT_FOUND ) err = ESP_OK;
+  }
+  if ( err == ESP_OK ) err = nvs_commit(nvsHandle);
+  nvs_close(nvsHandle);
+
+  if ( err != ESP_OK ) {
+    ESP_LOGI(TAG, "Error (%s) writing armed selection to NVS", esp_err_to_name(err));
+    return err;
+  }
+
+  portENTER_CRITICAL(&hid_lock);
+  armed_mode = mode;
+  armed_button = btn;
+  portEXIT_CRITICAL(&hid_lock);
+  return ESP_OK;
+}
+
+uint32_t hid_busy(void)
+{
+  return button_pressed;
+}
+
+uint32_t hid_armed(void)
+{
+  return armed_button;
+}
+
+int hid_status_json(char *buf, size_t len)
+{
+  hid_event_t events[HID_HISTORY_LEN];
+  uint32_t count, first;
+  int n;
+
+  portENTER_CRITICAL(&hid_lock);
+  count = hid_history_count;
+  memcpy(events, hid_history, sizeof(events));
+  portEXIT_CRITICAL(&hid_lock);
+
+  n = snprintf(buf, len,
+               "\"usb\":{\"mounted\":%s,\"suspended\":%s,\"protocol\":\"%s\",\"busy\":%u,\"armed\":%u,\"seq_reports\":%u,"
+               "\"leds\":%u,\"led_reports\":%u,\"led_report_ms\":%lld,\"led_change_ms\":%lld,"
+               "\"type\":{\"result\":\"%s\",\"layout\":\"%s\",\"chars\":%u,\"reports\":%u,\"ms\":%lld,\"cps\":%u},"
+               "\"dropped\":%u,\"events\":[",
+               usb_mounted ? "true" : "false", usb_suspended ? "true" : "false",
+               kbd_protocol ? "report" : "boot", button_pressed, armed_button, seq_reports,
+               led_state, led_reports, led_report_time / 1000, led_change_time / 1000,
+               (type_result < 0) ? "none" : seq_result_names[type_result], keymap_name(type_layout),
+               type_chars, type_reports, type_us / 1000,
+               type_us ? (uint32_t) ((int64_t) type_chars * 1000000 / type_us) : 0,
+               hid_queue_dropped);
+
+  first = (count > HID_HISTORY_LEN) ? count - HID_HISTORY_LEN : 0;
+  for (uint32_t i = first; (i < count) && (n < (int) len); i++) {
+    hid_event_t const *ev = &events[i % HID_HISTORY_LEN];
+    n += snprintf(buf + n, len - n, "%s{\"ms\":%lld,\"ev\":\"%s\",\"arg\":%u}",
+                  (i == first) ? "" : ",", ev->time / 1000, hid_event_names[ev->type], ev->arg);
+  }
+  if ( n < (int) len ) {
+    n += snprintf(buf + n, len - n, "]}");
+  }
+  return n;
+}
+
+//--------------------------------------------------------------------+
+// Device callbacks
+//--------------------------------------------------------------------+
+
+// Invoked when device is mounted
+void tud_mount_cb(void)
+{
+  hid_post(HID_EV_MOUNT, 0);
+}
+
+// Invoked when device is unmounted
+void tud_umount_cb(void)
+{
+  hid_post(HID_EV_UMOUNT, 0);
+#if CONFIG_WEBKEY_USB_NET
+  usb_net_umount();
+#endif
+}
+
+// Invoked when usb bus is suspended
+// remote_wakeup_en : if host allow us  to perform remote wakeup
+// Within 7ms, device must draw an average of current less than 2.5 mA from bus
+void tud_suspend_cb(bool remote_wakeup_en)
+{
+  hid_post(HID_EV_SUSPEND, remote_wakeup_en);
+}
+
+// Invoked when usb bus is resumed
+void tud_resume_cb(void)
+{
+  hid_post(HID_EV_RESUME, 0);
+}
+
+//--------------------------------------------------------------------+
+// USB HID
+//--------------------------------------------------------------------+
+
+// Invoked when received GET_REPORT control request
+// Application must fill buffer report's content and return its length.
+// Return zero will cause the stack to STALL request
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
+{
+  // TODO not Implemented
+  (void) instance;
+  (void) report_id;
+  (void) report_type;
+  (void) buffer;
+  (void) reqlen;
+
+  return 0;
+}
+
+// Invoked when received SET_REPORT control request or
+// received data on OUT endpoint ( Report ID = 0, Type = 0 )
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
+{
+  (void) report_id;
+
+  // Keyboard output report is the LED bitmap (NUMLOCK, CAPSLOCK etc...)
+  if ( (instance == ITF_NUM_KEYBOARD) && (report_type == HID_REPORT_TYPE_OUTPUT) && (bufsize > 0) ) {
+    hid_post(HID_EV_LEDS, buffer[0]);
+  }
+}
+
+// Invoked when received SET_PROTOCOL request
+// protocol is either HID_PROTOCOL_BOOT (0) or HID_PROTOCOL_REPORT (1)
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol)
+{
+  if ( instance == ITF_NUM_KEYBOARD ) {
+    hid_post(HID_EV_PROTOCOL, protocol);
+  }
+}
@@ -0,0 +1,101 @@
+/* HID key sequence engine
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef HID_TASK_H_
+#define HID_TASK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define HID_NUM_BUTTONS     4
+
+/* How a key sequence is started */
+enum
+{
+  SEQ_MODE_BLIND = 0,   // Lead-in of spaces at a fixed rate (works with any host)
+  SEQ_MODE_LED,         // Wait for the host to set the keyboard LEDs, then send minimal keys
+};
+
+/* Events feeding the engine, timestamped when they occur */
+typedef enum
+{
+  HID_EV_NONE = 0,
+  HID_EV_MOUNT,         // Host configured the device (first enumeration or after a reset)
+  HID_EV_UMOUNT,        // Device unplugged
+  HID_EV_SUSPEND,       // Bus suspended, arg = remote wakeup allowed
+  HID_EV_RESUME,        // Bus resumed
+  HID_EV_LEDS,          // Host wrote the keyboard LEDs, arg = LED bitmap
+  HID_EV_COMMAND,       // Key sequence requested, arg = button
+  HID_EV_PROTOCOL,      // Host selected keyboard protocol, arg = 0 boot / 1 report
+} hid_event_type_t;
+
+typedef struct
+{
+  int64_t time;         // esp_timer time (us)
+  uint8_t type;         // hid_event_type_t
+  uint8_t arg;
+} hid_event_t;
+
+/* Create the event queue and start the HID task, before USB and any control interface */
+void hid_init(void);
+
+/* Outcome of a control request, shared by every control interface */
+typedef enum
+{
+  HID_CMD_OK = 0,
+  HID_CMD_BUSY,
+  HID_CMD_BAD_SELECTION,
+} hid_cmd_result_t;
+
+/* Queue a key sequence, returns false if one is already pending */
+bool hid_submit(uint32_t btn, uint32_t mode);
+
+/* Validate and queue a key sequence */
+hid_cmd_result_t hid_command(uint32_t btn, uint32_t mode);
+
+#define HID_BTN_TYPE        0xFF      // Reported by hid_busy() while typing text
+#define HID_TYPE_MAX        256       // Longest text hid_type takes
+
+/* Queue text to type in a keymap layout, as fast as the host polls or with
+ * gap_ms after every report. Every character must exist in the layout. */
+hid_cmd_result_t hid_type(const char *text, size_t len, uint32_t layout, uint32_t gap_ms);
+
+#define HID_BTN_SYSTEM      0xFE      // Reported by hid_busy() while sending a System Control report
+#define HID_BTN_CONSUMER    0xFD      // Reported by hid_busy() while sending a Consumer Control report
+
+/* System Control actions, the report values of the control interface */
+enum
+{
+  HID_POWER_OFF = 1,    // System Power Down
+  HID_POWER_SLEEP,      // System Sleep
+  HID_POWER_WAKE,       // System Wake Up, signals remote wakeup first if the host is suspended
+};
+
+/* Queue a System Control press and release. Wake is refused while the host
+ * is suspended without allowing remote wakeup, nothing would reach it. */
+hid_cmd_result_t hid_power(uint32_t action);
+
+/* Queue a Consumer Control press and release of a consumer page usage */
+hid_cmd_result_t hid_consumer(uint32_t usage);
+
+/* Persist a selection that fires on the next host enumeration, 0 disarms */
+esp_err_t hid_arm(uint32_t btn, uint32_t mode);
+
+/* Button of the pending/running sequence, 0 when idle */
+uint32_t hid_busy(void);
+
+/* Armed button, 0 when none */
+uint32_t hid_armed(void);
+
+/* Write bus state and recent events as a JSON member, returns length */
+int hid_status_json(char *buf, size_t len);
+
+#endif /* HID_TASK_H_ */
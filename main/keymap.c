@@ -0,0 +1,105 @@
+/* ASCII to HID keyboard layouts
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include "tusb.h"
+
+#include "keymap.h"
+
+#define SHIFT               KEYBOARD_MODIFIER_LEFTSHIFT
+#define ALTGR               KEYBOARD_MODIFIER_RIGHTALT
+
+#define K(k)                { 0, HID_KEY_##k, 0 }
+#define S(k)                { SHIFT, HID_KEY_##k, 0 }
+#define G(k)                { ALTGR, HID_KEY_##k, 0 }
+#define DEAD(m, k)          { m, HID_KEY_##k, KEYMAP_F_DEAD }
+
+/* Shared by every layout here, y and z move on QWERTZ */
+#define KEYMAP_COMMON \
+    ['\t'] = K(TAB),            ['\n'] = K(RETURN),         [' '] = K(SPACE), \
+    ['a'] = K(A), ['b'] = K(B), ['c'] = K(C), ['d'] = K(D), ['e'] = K(E), ['f'] = K(F), \
+    ['g'] = K(G), ['h'] = K(H), ['i'] = K(I), ['j'] = K(J), ['k'] = K(K), ['l'] = K(L), \
+    ['m'] = K(M), ['n'] = K(N), ['o'] = K(O), ['p'] = K(P), ['q'] = K(Q), ['r'] = K(R), \
+    ['s'] = K(S), ['t'] = K(T), ['u'] = K(U), ['v'] = K(V), ['w'] = K(W), ['x'] = K(X), \
+    ['A'] = S(A), ['B'] = S(B), ['C'] = S(C), ['D'] = S(D), ['E'] = S(E), ['F'] = S(F), \
+    ['G'] = S(G), ['H'] = S(H), ['I'] = S(I), ['J'] = S(J), ['K'] = S(K), ['L'] = S(L), \
+    ['M'] = S(M), ['N'] = S(N), ['O'] = S(O), ['P'] = S(P), ['Q'] = S(Q), ['R'] = S(R), \
+    ['S'] = S(S), ['T'] = S(T), ['U'] = S(U), ['V'] = S(V), ['W'] = S(W), ['X'] = S(X), \
+    ['1'] = K(1), ['2'] = K(2), ['3'] = K(3), ['4'] = K(4), ['5'] = K(5), \
+    ['6'] = K(6), ['7'] = K(7), ['8'] = K(8), ['9'] = K(9), ['0'] = K(0), \
+    [','] = K(COMMA),           ['.'] = K(PERIOD)
+
+/* US and UK differ in a few symbols */
+#define KEYMAP_QWERTY \
+    ['y'] = K(Y),               ['z'] = K(Z),               ['Y'] = S(Y),               ['Z'] = S(Z), \
+    ['!'] = S(1),               ['$'] = S(4),               ['%'] = S(5),               ['^'] = S(6), \
+    ['&'] = S(7),               ['*'] = S(8),               ['('] = S(9),               [')'] = S(0), \
+    ['-'] = K(MINUS),           ['_'] = S(MINUS),           ['='] = K(EQUAL),           ['+'] = S(EQUAL), \
+    ['['] = K(BRACKET_LEFT),    ['{'] = S(BRACKET_LEFT),    [']'] = K(BRACKET_RIGHT),   ['}'] = S(BRACKET_RIGHT), \
+    [';'] = K(SEMICOLON),       [':'] = S(SEMICOLON),       ['\''] = K(APOSTROPHE),     ['`'] = K(GRAVE), \
+    ['<'] = S(COMMA),           ['>'] = S(PERIOD),          ['/'] = K(SLASH),           ['?'] = S(SLASH)
+
+static const keymap_key_t keymaps[KEYMAP_COUNT][128] = {
+    [KEYMAP_US] = {
+        KEYMAP_COMMON,
+        KEYMAP_QWERTY,
+        ['@'] = S(2),               ['#'] = S(3),               ['"'] = S(APOSTROPHE),      ['~'] = S(GRAVE),
+        ['\\'] = K(BACKSLASH),      ['|'] = S(BACKSLASH),
+    },
+    [KEYMAP_UK] = {
+        KEYMAP_COMMON,
+        KEYMAP_QWERTY,
+        ['"'] = S(2),               ['@'] = S(APOSTROPHE),      ['#'] = K(EUROPE_1),        ['~'] = S(EUROPE_1),
+        ['\\'] = K(EUROPE_2),       ['|'] = S(EUROPE_2),
+    },
+    [KEYMAP_DE] = {
+        KEYMAP_COMMON,
+        ['y'] = K(Z),               ['z'] = K(Y),               ['Y'] = S(Z),               ['Z'] = S(Y),
+        ['!'] = S(1),               ['"'] = S(2),               ['$'] = S(4),               ['%'] = S(5),
+        ['&'] = S(6),               ['/'] = S(7),               ['('] = S(8),               [')'] = S(9),
+        ['='] = S(0),               ['?'] = S(MINUS),           ['\\'] = G(MINUS),          ['`'] = DEAD(SHIFT, EQUAL),
+        ['+'] = K(BRACKET_RIGHT),   ['*'] = S(BRACKET_RIGHT),   ['~'] = G(BRACKET_RIGHT),   ['#'] = K(EUROPE_1),
+        ['\''] = S(EUROPE_1),       ['<'] = K(EUROPE_2),        ['>'] = S(EUROPE_2),        ['|'] = G(EUROPE_2),
+        [';'] = S(COMMA),           [':'] = S(PERIOD),          ['-'] = K(SLASH),           ['_'] = S(SLASH),
+        ['^'] = DEAD(0, GRAVE),     ['@'] = G(Q),               ['{'] = G(7),               ['['] = G(8),
+        [']'] = G(9),               ['}'] = G(0),
+    },
+};
+
+static const char *const keymap_names[KEYMAP_COUNT] = {
+    [KEYMAP_US] = "us",
+    [KEYMAP_UK] = "uk",
+    [KEYMAP_DE] = "de",
+};
+
+int keymap_find(const char *name)
+{
+    for (int i = 0; i < KEYMAP_COUNT; i++) {
+        if (strcmp(name, keymap_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char *keymap_name(int layout)
+{
+    return ((layout >= 0) && (layout < KEYMAP_COUNT)) ? keymap_names[layout] : "?";
+}
+
+const keymap_key_t *keymap_lookup(int layout, char c)
+{
+    const keymap_key_t *k;
+
+    if ((layout < 0) || (layout >= KEYMAP_COUNT) || ((unsigned char) c >= 128))
+        return NULL;
+    k = &keymaps[layout][(unsigned char) c];
+    return k->key ? k : NULL;
+}
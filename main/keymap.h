@@ -0,0 +1,45 @@
+/* ASCII to HID keyboard layouts
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+
+#include <stdint.h>
+
+/* The host decides what a keycode means, so the text is converted with the
+ * table for the layout the host has configured. Tables are const arrays
+ * indexed by character and built by the compiler. */
+
+typedef enum
+{
+    KEYMAP_US = 0,
+    KEYMAP_UK,
+    KEYMAP_DE,
+    KEYMAP_COUNT
+} keymap_layout_t;
+
+#define KEYMAP_F_DEAD       0x01        // Dead key, a space must follow to get the character
+
+typedef struct
+{
+    uint8_t modifier;           // KEYBOARD_MODIFIER_*
+    uint8_t key;                // HID_KEY_*, 0 if the layout cannot type the character
+    uint8_t flags;              // KEYMAP_F_*
+} keymap_key_t;
+
+/* Layout by name ("us", "uk", "de"), -1 if unknown */
+int keymap_find(const char *name);
+
+/* Name of a layout */
+const char *keymap_name(int layout);
+
+/* Key for a character, NULL if the layout has none */
+const keymap_key_t *keymap_lookup(int layout, char c);
+
+#endif /* KEYMAP_H_ */
@@ -0,0 +1,224 @@
+/* Lead-in timing learned from host boots
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+
+#include "leadin.h"
+
+/* Should put these in .h file(s) */
+extern const char *TAG;
+
+#define LEADIN_HISTORY      8           // Boots kept
+#define LEADIN_MIN_BOOTS    2           // Boots seen before the history is trusted
+#define LEADIN_WINDOW_MS    120000      // Later signals are the OS, not boot firmware
+#define LEADIN_RESET_MS     10000       // Unmount to mount within this is a bus reset
+#define LEADIN_MARGIN_MS    1000        // Slack either side of the window, plus 1/8 of its end
+#define LEADIN_VERSION      1
+
+/* One boot, times from enumeration, 0 when the event never came */
+typedef struct
+{
+    uint32_t reset_ms;          // Unmount to mount, 0 on a fresh attach
+    uint32_t protocol_ms;       // First SET_PROTOCOL
+    uint32_t leds_ms;           // First LED report
+} leadin_boot_t;
+
+typedef struct
+{
+    uint8_t version;            // LEADIN_VERSION
+    uint8_t count;              // Boots in use
+    uint8_t next;               // Slot the next boot goes to
+    uint8_t reserved;
+    leadin_boot_t boots[LEADIN_HISTORY];
+} leadin_store_t;
+
+/* Local storage */
+static leadin_store_t leadin_store = { .version = LEADIN_VERSION };
+static bool           leadin_dirty = false;
+static portMUX_TYPE   leadin_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Timeline of the current boot, only touched by the HID task
+static int64_t        mount_time = 0;       // us, 0 while unmounted
+static int64_t        umount_time = 0;
+static leadin_boot_t  boot_now;
+static bool           boot_open = false;
+
+// Last plan, for /status
+static leadin_plan_t  last_plan = { 0, LEADIN_MAX_KEYS, false };
+
+/* When the firmware of a boot started reading keys */
+static uint32_t boot_ready_ms(const leadin_boot_t *b)
+{
+    return b->leds_ms ? b->leds_ms : b->protocol_ms;
+}
+
+/* Close the current timeline, keeping it if the host ever showed it was listening */
+static void leadin_close(void)
+{
+    if (!boot_open)
+        return;
+    boot_open = false;
+    if (boot_ready_ms(&boot_now) == 0)
+        return;
+
+    portENTER_CRITICAL(&leadin_lock);
+    leadin_store.boots[leadin_store.next] = boot_now;
+    leadin_store.next = (leadin_store.next + 1) % LEADIN_HISTORY;
+    if (leadin_store.count < LEADIN_HISTORY)
+        leadin_store.count++;
+    leadin_dirty = true;
+    portEXIT_CRITICAL(&leadin_lock);
+    ESP_LOGI(TAG, "Host boot: reset %u ms, protocol %u ms, leds %u ms",
+             boot_now.reset_ms, boot_now.protocol_ms, boot_now.leds_ms);
+}
+
+void leadin_init(void)
+{
+    nvs_handle_t nvsHandle;
+    leadin_store_t store;
+    size_t len = sizeof(store);
+
+    if (nvs_open("storage", NVS_READONLY, &nvsHandle) == ESP_OK) {
+        esp_err_t res = nvs_get_blob(nvsHandle, "LEADIN", &store, &len);
+        nvs_close(nvsHandle);
+        if ((res == ESP_OK) && (len == sizeof(store)) && (store.version == LEADIN_VERSION) &&
+            (store.count <= LEADIN_HISTORY) && (store.next < LEADIN_HISTORY)) {
+            leadin_store = store;
+            ESP_LOGI(TAG, "Lead-in history: %u boots", store.count);
+        }
+    }
+}
+
+void leadin_event(const hid_event_t *ev)
+{
+    uint32_t const ms = MAX((ev->time - mount_time) / 1000, 1);
+
+    switch (ev->type) {
+    case HID_EV_MOUNT:
+        leadin_close();
+        memset(&boot_now, 0, sizeof(boot_now));
+        if (umount_time && (ev->time - umount_time < (int64_t) LEADIN_RESET_MS * 1000))
+            boot_now.reset_ms = MAX((ev->time - umount_time) / 1000, 1);
+        mount_time = ev->time;
+        boot_open = true;
+        break;
+    case HID_EV_UMOUNT:
+        leadin_close();
+        umount_time = ev->time;
+        mount_time = 0;
+        break;
+    case HID_EV_PROTOCOL:
+        if (boot_open && (boot_now.protocol_ms == 0) && (ms < LEADIN_WINDOW_MS))
+            boot_now.protocol_ms = ms;
+        break;
+    case HID_EV_LEDS:
+        // The first LED report settles it, the rest of the boot adds nothing
+        if (boot_open && (ms < LEADIN_WINDOW_MS)) {
+            boot_now.leds_ms = ms;
+            leadin_close();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void leadin_plan(uint32_t gap_ms, leadin_plan_t *plan)
+{
+    uint32_t lo = UINT32_MAX, hi = 0, start, end, since;
+    uint8_t count;
+
+    plan->wait_ms = 0;
+    plan->count = LEADIN_MAX_KEYS;
+    plan->learned = false;
+
+    portENTER_CRITICAL(&leadin_lock);
+    count = leadin_store.count;
+    for (int i = 0; i < count; i++) {
+        uint32_t const ready = boot_ready_ms(&leadin_store.boots[i]);
+        lo = MIN(lo, ready);
+        hi = MAX(hi, ready);
+    }
+    portEXIT_CRITICAL(&leadin_lock);
+
+    // Without a history, or long after enumeration when the host could be anywhere, keep the full lead-in
+    if ((count >= LEADIN_MIN_BOOTS) && mount_time && gap_ms) {
+        uint32_t const margin = LEADIN_MARGIN_MS + hi / 8;
+        start = (lo > margin) ? lo - margin : 0;
+        end = hi + margin;
+        since = (esp_timer_get_time() - mount_time) / 1000;
+        if (since < end) {
+            if (since < start)
+                plan->wait_ms = start - since;
+            else
+                start = since;
+            plan->count = MIN((end - start) / gap_ms + 1, LEADIN_MAX_KEYS);
+            plan->learned = true;
+        }
+    }
+    last_plan = *plan;
+}
+
+bool leadin_pending(void)
+{
+    return leadin_dirty;
+}
+
+void leadin_save(void)
+{
+    nvs_handle_t nvsHandle;
+    leadin_store_t store;
+    esp_err_t err;
+
+    if (!leadin_dirty)
+        return;
+    portENTER_CRITICAL(&leadin_lock);
+    store = leadin_store;
+    leadin_dirty = false;
+    portEXIT_CRITICAL(&leadin_lock);
+
+    err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvsHandle, "LEADIN", &store, sizeof(store));
+        if (err == ESP_OK)
+            err = nvs_commit(nvsHandle);
+        nvs_close(nvsHandle);
+    }
+    if (err != ESP_OK)
+        ESP_LOGI(TAG, "Error (%s) writing lead-in history to NVS", esp_err_to_name(err));
+}
+
+int leadin_status_json(char *buf, size_t len)
+{
+    leadin_store_t store;
+    int n;
+
+    portENTER_CRITICAL(&leadin_lock);
+    store = leadin_store;
+    portEXIT_CRITICAL(&leadin_lock);
+
+    n = snprintf(buf, len, "\"leadin\":{\"learned\":%s,\"wait_ms\":%u,\"count\":%u,\"boots\":[",
+                 last_plan.learned ? "true" : "false", last_plan.wait_ms, last_plan.count);
+
+    // Oldest first
+    for (int i = 0; (i < store.count) && (n < (int) len); i++) {
+        const leadin_boot_t *b = &store.boots[(store.next + LEADIN_HISTORY - store.count + i) % LEADIN_HISTORY];
+        n += snprintf(buf + n, len - n, "%s{\"reset_ms\":%u,\"protocol_ms\":%u,\"leds_ms\":%u}",
+                      i ? "," : "", b->reset_ms, b->protocol_ms, b->leds_ms);
+    }
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n, "]}");
+    return n;
+}
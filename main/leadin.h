@@ -0,0 +1,51 @@
+/* Lead-in timing learned from host boots
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef LEADIN_H_
+#define LEADIN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hid_task.h"
+
+/* Every enumeration starts a timeline of the bus events that follow it. The
+ * first LED report (or SET_PROTOCOL on hosts that never write LEDs) is when
+ * that boot's firmware started reading keys. The last few boots are kept in
+ * NVS and the blind lead-in only covers the window they span. */
+
+#define LEADIN_MAX_KEYS     30          // Lead-in without history, and the most ever sent
+
+typedef struct
+{
+    uint32_t wait_ms;           // Delay before the first space
+    uint32_t count;             // Spaces to send
+    bool learned;               // From history, else the fixed lead-in
+} leadin_plan_t;
+
+/* Load the boot history from NVS (LEADIN) */
+void leadin_init(void);
+
+/* Feed a bus event, called by the HID task for every event it takes */
+void leadin_event(const hid_event_t *ev);
+
+/* Lead-in for a blind sequence starting now with 'gap_ms' between spaces */
+void leadin_plan(uint32_t gap_ms, leadin_plan_t *plan);
+
+/* True while there is history leadin_save would write */
+bool leadin_pending(void);
+
+/* Write new history to NVS, called by the HID task once the bus is quiet */
+void leadin_save(void);
+
+/* Write history and the last plan as a JSON member, returns length */
+int leadin_status_json(char *buf, size_t len);
+
+#endif /* LEADIN_H_ */
@@ -0,0 +1,376 @@
+/* Per-button keystroke macros
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <esp_log.h>
+#include <nvs_flash.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "tusb.h"
+
+#include "macro.h"
+
+/* Should put these in .h file(s) */
+extern const char *TAG;
+
+#define MACRO_VERSION       1
+#define KEY_HOLD_MS         10          // Same as hid_task.c
+
+/* Stored form, saved to NVS up to the last used step */
+typedef struct __attribute__((packed))
+{
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t total;                     // Steps used
+    struct __attribute__((packed)) {
+        char label[MACRO_LABEL_LEN];
+        uint8_t first;
+        uint8_t count;
+    } buttons[HID_NUM_BUTTONS];
+    macro_step_t steps[MACRO_MAX_STEPS];
+} macro_store_t;
+
+/* Allow-list of key names besides a-z, 0-9 and f1-f12 */
+typedef struct
+{
+    const char *name;
+    uint8_t key;
+} macro_key_t;
+
+static const macro_key_t macro_keys[] = {
+    { "enter",      HID_KEY_RETURN },
+    { "esc",        HID_KEY_ESCAPE },
+    { "backspace",  HID_KEY_BACKSPACE },
+    { "tab",        HID_KEY_TAB },
+    { "space",      HID_KEY_SPACE },
+    { "insert",     HID_KEY_INSERT },
+    { "delete",     HID_KEY_DELETE },
+    { "home",       HID_KEY_HOME },
+    { "end",        HID_KEY_END },
+    { "pageup",     HID_KEY_PAGE_UP },
+    { "pagedown",   HID_KEY_PAGE_DOWN },
+    { "up",         HID_KEY_ARROW_UP },
+    { "down",       HID_KEY_ARROW_DOWN },
+    { "left",       HID_KEY_ARROW_LEFT },
+    { "right",      HID_KEY_ARROW_RIGHT },
+};
+
+static const macro_key_t macro_modifiers[] = {
+    { "ctrl",       KEYBOARD_MODIFIER_LEFTCTRL },
+    { "shift",      KEYBOARD_MODIFIER_LEFTSHIFT },
+    { "alt",        KEYBOARD_MODIFIER_LEFTALT },
+    { "gui",        KEYBOARD_MODIFIER_LEFTGUI },
+};
+
+#define ARRAY_LEN(a)        (sizeof(a) / sizeof((a)[0]))
+
+/* The selections the firmware has always made: n-1 down arrows and Enter */
+static const macro_src_t macro_defaults[HID_NUM_BUTTONS] = {
+    { "Windows",    "enter" },
+    { "Linux",      "down enter" },
+    { "",           "down down enter" },
+    { "Setup",      "down down down enter" },
+};
+
+/* Local storage, the HID task plays from the active copy while a save
+ * fills the other */
+static macro_store_t macro_stores[2];
+static volatile int macro_active = 0;
+static SemaphoreHandle_t macro_mutex = NULL;
+static StaticSemaphore_t macro_mutex_buf;
+
+/* Key code for a name from the allow-list, 0 if it is not allowed */
+static uint8_t macro_lookup_key(const char *name)
+{
+    size_t const len = strlen(name);
+
+    if ((len == 1) && (name[0] >= 'a') && (name[0] <= 'z'))
+        return HID_KEY_A + (name[0] - 'a');
+    if ((len == 1) && (name[0] >= '1') && (name[0] <= '9'))
+        return HID_KEY_1 + (name[0] - '1');
+    if ((len == 1) && (name[0] == '0'))
+        return HID_KEY_0;
+    if ((len >= 2) && (len <= 3) && (name[0] == 'f') && isdigit((int) name[1])) {
+        int n = atoi(name + 1);
+        if ((n >= 1) && (n <= 12) && (len == ((n >= 10) ? 3 : 2)))
+            return HID_KEY_F1 + (n - 1);
+    }
+    for (int i = 0; i < ARRAY_LEN(macro_keys); i++) {
+        if (strcmp(name, macro_keys[i].name) == 0)
+            return macro_keys[i].key;
+    }
+    return 0;
+}
+
+/* Name for a key code, for showing stored macros */
+static int macro_key_name(uint8_t key, char *buf, size_t len)
+{
+    if ((key >= HID_KEY_A) && (key < HID_KEY_A + 26))
+        return snprintf(buf, len, "%c", 'a' + (key - HID_KEY_A));
+    if ((key >= HID_KEY_1) && (key < HID_KEY_1 + 9))
+        return snprintf(buf, len, "%c", '1' + (key - HID_KEY_1));
+    if (key == HID_KEY_0)
+        return snprintf(buf, len, "0");
+    if ((key >= HID_KEY_F1) && (key < HID_KEY_F1 + 12))
+        return snprintf(buf, len, "f%d", 1 + (key - HID_KEY_F1));
+    for (int i = 0; i < ARRAY_LEN(macro_keys); i++) {
+        if (macro_keys[i].key == key)
+            return snprintf(buf, len, "%s", macro_keys[i].name);
+    }
+    return snprintf(buf, len, "0x%02x", key);
+}
+
+/* Append one step, false when the store is full */
+static bool macro_emit(macro_store_t *store, uint8_t modifier, uint8_t key, uint16_t delay_ms)
+{
+    if (store->total >= MACRO_MAX_STEPS)
+        return false;
+    store->steps[store->total].modifier = modifier;
+    store->steps[store->total].key = key;
+    store->steps[store->total].delay_ms = delay_ms;
+    store->total++;
+    return true;
+}
+
+/* Compile one button's text onto the end of the store, a NULL label or
+ * text keeps what the button has now */
+static bool macro_compile(macro_store_t *store, int btn, const macro_src_t *src, char *err, size_t err_len)
+{
+    const macro_store_t *now = &macro_stores[macro_active];
+    char text[MACRO_TEXT_LEN];
+    char *save, *token;
+
+    if (src->label == NULL) {
+        strlcpy(store->buttons[btn].label, now->buttons[btn].label, MACRO_LABEL_LEN);
+    } else if (strlen(src->label) >= MACRO_LABEL_LEN) {
+        snprintf(err, err_len, "b%d: label is too long", btn + 1);
+        return false;
+    } else {
+        for (const char *c = src->label; *c; c++) {
+            if ((*c < 0x20) || (*c > 0x7e) || strchr("\"\\<>&", *c)) {
+                snprintf(err, err_len, "b%d: label may not contain '%c'", btn + 1, *c);
+                return false;
+            }
+        }
+        strlcpy(store->buttons[btn].label, src->label, MACRO_LABEL_LEN);
+    }
+    store->buttons[btn].first = store->total;
+
+    if (src->text == NULL) {
+        if (store->total + now->buttons[btn].count > MACRO_MAX_STEPS)
+            goto full;
+        memcpy(&store->steps[store->total], &now->steps[now->buttons[btn].first],
+               now->buttons[btn].count * sizeof(macro_step_t));
+        store->total += now->buttons[btn].count;
+        store->buttons[btn].count = now->buttons[btn].count;
+        return true;
+    }
+    if (strlen(src->text) >= MACRO_TEXT_LEN) {
+        snprintf(err, err_len, "b%d: keys are too long", btn + 1);
+        return false;
+    }
+
+    strlcpy(text, src->text, sizeof(text));
+    for (token = strtok_r(text, " \t\r\n,", &save); token != NULL; token = strtok_r(NULL, " \t\r\n,", &save)) {
+        uint8_t modifier = 0, key = 0;
+        char *part, *plus;
+
+        for (char *c = token; *c; c++)
+            *c = tolower((int) *c);
+
+        if (strncmp(token, "wait:", 5) == 0) {
+            char *end;
+            long ms = strtol(token + 5, &end, 10);
+            if ((*end != '\0') || (ms < 1) || (ms > MACRO_MAX_WAIT_MS)) {
+                snprintf(err, err_len, "b%d: bad wait '%s' (1-%d ms)", btn + 1, token + 5, MACRO_MAX_WAIT_MS);
+                return false;
+            }
+            /* Lengthen the previous release, or start with a pause */
+            if ((store->total > store->buttons[btn].first) &&
+                (store->steps[store->total - 1].delay_ms + ms <= UINT16_MAX)) {
+                store->steps[store->total - 1].delay_ms += ms;
+                continue;
+            }
+            if (!macro_emit(store, 0, 0, ms))
+                goto full;
+            continue;
+        }
+
+        /* [modifier+]...key */
+        for (part = token; (plus = strchr(part, '+')) != NULL; part = plus + 1) {
+            int i;
+            *plus = '\0';
+            for (i = 0; i < ARRAY_LEN(macro_modifiers); i++) {
+                if (strcmp(part, macro_modifiers[i].name) == 0)
+                    break;
+            }
+            if (i == ARRAY_LEN(macro_modifiers)) {
+                snprintf(err, err_len, "b%d: unknown modifier '%s'", btn + 1, part);
+                return false;
+            }
+            modifier |= macro_modifiers[i].key;
+        }
+        key = macro_lookup_key(part);
+        if (key == 0) {
+            snprintf(err, err_len, "b%d: key '%s' is not allowed", btn + 1, part);
+            return false;
+        }
+        if (!macro_emit(store, modifier, key, KEY_HOLD_MS) || !macro_emit(store, 0, 0, 0))
+            goto full;
+    }
+
+    store->buttons[btn].count = store->total - store->buttons[btn].first;
+    return true;
+
+full:
+    snprintf(err, err_len, "b%d: macros are limited to %d reports in total", btn + 1, MACRO_MAX_STEPS);
+    return false;
+}
+
+static bool macro_compile_all(macro_store_t *store, const macro_src_t src[HID_NUM_BUTTONS], char *err, size_t err_len)
+{
+    memset(store, 0, sizeof(*store));
+    store->version = MACRO_VERSION;
+    for (int i = 0; i < HID_NUM_BUTTONS; i++) {
+        if (!macro_compile(store, i, &src[i], err, err_len))
+            return false;
+    }
+    return true;
+}
+
+/* Check a blob read back from NVS before playing it */
+static bool macro_valid(const macro_store_t *store, size_t len)
+{
+    if ((len < offsetof(macro_store_t, steps)) || (store->version != MACRO_VERSION) ||
+        (store->total > MACRO_MAX_STEPS) ||
+        (len != offsetof(macro_store_t, steps) + store->total * sizeof(macro_step_t)))
+        return false;
+    for (int i = 0; i < HID_NUM_BUTTONS; i++) {
+        if ((store->buttons[i].first + store->buttons[i].count > store->total) ||
+            (memchr(store->buttons[i].label, '\0', MACRO_LABEL_LEN) == NULL))
+            return false;
+    }
+    return true;
+}
+
+void macro_init(void)
+{
+    macro_store_t *store = &macro_stores[0];
+    nvs_handle_t nvsHandle;
+    size_t len = sizeof(*store);
+    char err[64];
+
+    macro_mutex = xSemaphoreCreateMutexStatic(&macro_mutex_buf);
+    if (nvs_open("storage", NVS_READONLY, &nvsHandle) == ESP_OK) {
+        esp_err_t res = nvs_get_blob(nvsHandle, "MACROS", store, &len);
+        nvs_close(nvsHandle);
+        if ((res == ESP_OK) && macro_valid(store, len)) {
+            macro_active = 0;
+            ESP_LOGI(TAG, "Macros loaded, %u reports", store->total);
+            return;
+        }
+    }
+    if (!macro_compile_all(store, macro_defaults, err, sizeof(err)))
+        ESP_LOGE(TAG, "Default macros: %s", err);
+    macro_active = 0;
+}
+
+uint32_t macro_get(uint32_t btn, const macro_step_t **steps)
+{
+    const macro_store_t *store = &macro_stores[macro_active];
+
+    if ((btn < 1) || (btn > HID_NUM_BUTTONS))
+        return 0;
+    *steps = &store->steps[store->buttons[btn - 1].first];
+    return store->buttons[btn - 1].count;
+}
+
+esp_err_t macro_save(const macro_src_t src[HID_NUM_BUTTONS], char *err, size_t err_len)
+{
+    int next;
+    macro_store_t *store;
+    nvs_handle_t nvsHandle;
+    esp_err_t res;
+
+    /* The task may still be walking the other copy */
+    xSemaphoreTake(macro_mutex, portMAX_DELAY);
+    next = !macro_active;
+    store = &macro_stores[next];
+    if (hid_busy()) {
+        xSemaphoreGive(macro_mutex);
+        snprintf(err, err_len, "busy typing, try again");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!macro_compile_all(store, src, err, err_len)) {
+        xSemaphoreGive(macro_mutex);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    res = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+    if (res == ESP_OK) {
+        res = nvs_set_blob(nvsHandle, "MACROS", store,
+                           offsetof(macro_store_t, steps) + store->total * sizeof(macro_step_t));
+        if (res == ESP_OK)
+            res = nvs_commit(nvsHandle);
+        nvs_close(nvsHandle);
+    }
+    if (res == ESP_OK)
+        macro_active = next;
+    else
+        snprintf(err, err_len, "error (%s) writing NVS", esp_err_to_name(res));
+    xSemaphoreGive(macro_mutex);
+    return res;
+}
+
+/* Turn stored reports back into text */
+static int macro_text(const macro_store_t *store, int btn, char *buf, size_t len)
+{
+    const macro_step_t *step = &store->steps[store->buttons[btn].first];
+    int n = 0;
+
+    for (int i = 0; (i < store->buttons[btn].count) && (n < (int) len); i++, step++) {
+        if ((step->key == 0) && (step->modifier == 0)) {
+            if (step->delay_ms)
+                n += snprintf(buf + n, len - n, "%swait:%u", n ? " " : "", step->delay_ms);
+            continue;
+        }
+        if (n > 0)
+            n += snprintf(buf + n, (n < (int) len) ? len - n : 0, " ");
+        for (int m = 0; m < ARRAY_LEN(macro_modifiers); m++) {
+            if ((step->modifier & macro_modifiers[m].key) && (n < (int) len))
+                n += snprintf(buf + n, len - n, "%s+", macro_modifiers[m].name);
+        }
+        if (n < (int) len)
+            n += macro_key_name(step->key, buf + n, len - n);
+    }
+    return n;
+}
+
+int macro_json(char *buf, size_t len)
+{
+    const macro_store_t *store = &macro_stores[macro_active];
+    int n = snprintf(buf, len, "{\"buttons\":[");
+
+    for (int i = 0; (i < HID_NUM_BUTTONS) && (n < (int) len); i++) {
+        n += snprintf(buf + n, len - n, "%s{\"key\":\"b%d\",\"label\":\"%s\",\"text\":\"",
+                      i ? "," : "", i + 1, store->buttons[i].label);
+        if (n < (int) len)
+            n += macro_text(store, i, buf + n, len - n);
+        if (n < (int) len)
+            n += snprintf(buf + n, len - n, "\"}");
+    }
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n, "]}\n");
+    return n;
+}
@@ -0,0 +1,53 @@
+/* Per-button keystroke macros
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef MACRO_H_
+#define MACRO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#include "hid_task.h"
+#include "hid_sched.h"
+
+/* Each button has a label for the web page and the keys it sends after the
+ * lead-in, written as text such as "down down enter" or "ctrl+alt+delete
+ * wait:2000 f2". Only key names in the allow-list in macro.c are accepted.
+ * Text is compiled when saved into keyboard reports, which are what is kept
+ * in NVS (MACROS blob) and walked by the HID task without any parsing. */
+
+#define MACRO_LABEL_LEN     24
+#define MACRO_TEXT_LEN      256
+#define MACRO_MAX_STEPS     128         // Reports for all buttons together
+#define MACRO_MAX_WAIT_MS   10000
+
+/* One keyboard report and the time to hold it, played by hid_sched_play */
+typedef hid_sched_step_t macro_step_t;
+
+/* Macro source for one button, as edited on the config page */
+typedef struct
+{
+    const char *label;
+    const char *text;
+} macro_src_t;
+
+/* Load macros from NVS, or the built-in defaults */
+void macro_init(void);
+
+/* Reports for a button, returns their number, 0 if the button has no macro */
+uint32_t macro_get(uint32_t btn, const macro_step_t **steps);
+
+/* Compile and store all buttons, on error nothing changes and err says why */
+esp_err_t macro_save(const macro_src_t src[HID_NUM_BUTTONS], char *err, size_t err_len);
+
+/* Write {"buttons":[{"key":"b1","label":...,"text":...},...]} */
+int macro_json(char *buf, size_t len);
+
+#endif /* MACRO_H_ */
@@ -12,23 +12,23 @@
 #include <string.h>
 #include <esp_log.h>
 #include <nvs_flash.h>
+#include "esp_netif.h"
 
 const char *TAG = "webkey";
 
-extern int32_t web_server_down;
-
 /* Forware declaration */
-void wifi_init_sta( int32_t, const char *, const char * );
+void wifi_aps_init(void);
+void wifi_init_sta(void);
 void server_init(void);
 void usb_init(void);
+void hid_init(void);
+void auth_init(void);
+void ctrl_udp_init(void);
+void audit_init(void);
 
 /* Main application */
 void app_main(void)
 {
-    size_t nvs_len;
-    char wifi_ssid[33];
-    char wifi_pass[65];
-
     // Initialize NVS subsystem
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -39,45 +39,31 @@ void app_main(void)
     }
     ESP_ERROR_CHECK( err );
 
-    // Get SSID/password from NVS
-    nvs_handle_t nvsHandle;
-    err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
-    if (err != ESP_OK) {
-        ESP_LOGI(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-        strlcpy(wifi_ssid, CONFIG_ESP_WIFI_SSID, sizeof(wifi_ssid));
-        strlcpy(wifi_pass, CONFIG_ESP_WIFI_PASSWORD, sizeof(wifi_pass));
-    } else {
-        nvs_len = sizeof(wifi_ssid);
-        err = nvs_get_str(nvsHandle, "WIFI_SSID", wifi_ssid, &nvs_len);
-        if ( err != ESP_OK ) {
-            ESP_LOGI(TAG, "WiFi SSID not set, using default");
-            strlcpy(wifi_ssid, CONFIG_ESP_WIFI_SSID, sizeof(wifi_ssid));
-        } else
-        nvs_len = sizeof(wifi_pass);
-        err = nvs_get_str(nvsHandle, "WIFI_PASS", wifi_pass, &nvs_len);
-        if ( err != ESP_OK ) {
-            ESP_LOGI(TAG, "WiFi password not set, using default");
-            strlcpy(wifi_pass, CONFIG_ESP_WIFI_PASSWORD, sizeof(wifi_pass));
-        }
-        nvs_close(nvsHandle);
-    }
+    // Open the audit log, it records this boot
+    audit_init();
+
+    // HID engine, its queue and the macros must exist before a request can post to them
+    hid_init();
+
+    // Start USB before WiFi, the webkey powers up with the host and the first
+    // enumeration (and the armed selection) must not wait for the network.
+    // The lwIP thread comes first for the USB network interface.
+    ESP_ERROR_CHECK(esp_netif_init());
+    usb_init();
+
+    // Get known networks from NVS
+    wifi_aps_init();
 
     // Start WiFi
     ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
-    wifi_init_sta( 0, wifi_ssid, wifi_pass );
+    wifi_init_sta();
+
+    // Load device key before any control interface is up
+    auth_init();
 
     // Start webserver
     server_init();
 
-    // Start USB
-    usb_init();
-
-    // Watch for connection loss and try reconnect
-    while (1) {
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        if ( web_server_down ) {
-            web_server_down = 0;
-            wifi_init_sta( 1, wifi_ssid, wifi_pass );
-        }
-    }
+    // Start binary control port
+    ctrl_udp_init();
 }
@@ -7,11 +7,17 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <stdio.h>
+#include <string.h>
 #include <esp_log.h>
 #include <esp_system.h>
 #include <sys/param.h>
 #include "esp_partition.h"
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include <esp_http_server.h>
+
+#include "wifi_ps.h"
 
 /* Should put these in .h file(s) */
 extern const char *TAG;
@@ -20,14 +26,54 @@ extern const char *TAG;
 static const esp_partition_t *update_partition = NULL;
 static esp_ota_handle_t update_handle = 0;
 
+/* Per-chunk timing of the last (or current) update. Histogram bucket n
+ * counts chunks that took [2^(n+6), 2^(n+7)) us, the first and last
+ * buckets also take anything shorter or longer. */
+#define OTA_HIST_BUCKETS    16
+
+typedef struct {
+    uint32_t count;
+    uint32_t hist[OTA_HIST_BUCKETS];
+    int64_t total_us;
+    int64_t max_us;
+} ota_timing_t;
+
+static struct {
+    int64_t start;
+    int64_t elapsed_us;         // 0 while running
+    uint32_t bytes;
+    uint32_t timeouts;          // httpd_req_recv timeouts that were retried
+    int64_t timeout_us;
+    esp_err_t result;
+    ota_timing_t recv;
+    ota_timing_t write;
+} ota_stats;
+
+static void ota_timing_add(ota_timing_t *t, int64_t us)
+{
+    int bucket = 0;
+
+    while ((bucket < OTA_HIST_BUCKETS - 1) && (us >= (128LL << bucket)))
+        bucket++;
+    t->hist[bucket]++;
+    t->count++;
+    t->total_us += us;
+    t->max_us = MAX(t->max_us, us);
+}
+
 /* Setup for OTA operation */
 esp_err_t ota_init(void)
 {
     esp_err_t err;
 
+    memset(&ota_stats, 0, sizeof(ota_stats));
+    ota_stats.start = esp_timer_get_time();
+
     update_partition = esp_ota_get_next_update_partition(NULL);
     if ( update_partition == NULL ) {
         ESP_LOGI(TAG, "Error: update_partition is NULL");
+        ota_stats.result = ESP_FAIL;
+        ota_stats.elapsed_us = 1;
         return ESP_FAIL;
     }
     ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x",
@@ -35,15 +81,36 @@ esp_err_t ota_init(void)
     err = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
+        ota_stats.result = err;
+        ota_stats.elapsed_us = 1;
         return err;
     }
+
+    // Keep the radio awake for the upload, released by ota_finish
+    wifi_ps_hold(true);
     return ESP_OK;
 }
 
+/* Account for one httpd_req_recv call, ret as it returned */
+void ota_recv_time(int64_t us, int ret)
+{
+    if (ret > 0) {
+        ota_timing_add(&ota_stats.recv, us);
+        ota_stats.bytes += ret;
+    } else if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+        ota_stats.timeouts++;
+        ota_stats.timeout_us += us;
+    }
+}
+
 /* Write a chunk of data */
 esp_err_t ota_write(char *buf, int len)
 {
-    return esp_ota_write( update_handle, (const void *)buf, len);
+    int64_t const start = esp_timer_get_time();
+    esp_err_t const err = esp_ota_write( update_handle, (const void *)buf, len);
+
+    ota_timing_add(&ota_stats.write, esp_timer_get_time() - start);
+    return err;
 }
 
 /* Finalize the OTA operation */
@@ -52,7 +119,13 @@ esp_err_t ota_finish(esp_err_t old_err)
     esp_err_t err;
 
     ESP_LOGI(TAG, "Update writing complete");
+    wifi_ps_hold(false);
     err = esp_ota_end(update_handle);
+    ota_stats.elapsed_us = MAX(esp_timer_get_time() - ota_stats.start, 1);
+    ota_stats.result = (err != ESP_OK) ? err : old_err;
+    ESP_LOGI(TAG, "Update %u bytes in %lld ms, recv %lld ms, write %lld ms, %u timeouts",
+             ota_stats.bytes, ota_stats.elapsed_us / 1000, ota_stats.recv.total_us / 1000,
+             ota_stats.write.total_us / 1000, ota_stats.timeouts);
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
             ESP_LOGE(TAG, "Image validation failed, image is corrupted");
@@ -65,6 +138,7 @@ esp_err_t ota_finish(esp_err_t old_err)
         err = esp_ota_set_boot_partition(update_partition);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
+            ota_stats.result = err;
             return err;
         }
         //ESP_LOGI(TAG, "Prepare to restart system!");
@@ -75,3 +149,40 @@ esp_err_t ota_finish(esp_err_t old_err)
     // If an error was passed in, return it
     return old_err;
 }
+
+static int ota_timing_json(char *buf, size_t len, const char *name, const ota_timing_t *t)
+{
+    int n = snprintf(buf, len, "\"%s\":{\"chunks\":%u,\"ms\":%lld,\"max_us\":%lld,\"hist\":[",
+                     name, t->count, t->total_us / 1000, t->max_us);
+
+    for (int i = 0; (i < OTA_HIST_BUCKETS) && (n < (int) len); i++)
+        n += snprintf(buf + n, len - n, "%s%u", i ? "," : "", t->hist[i]);
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n, "]}");
+    return n;
+}
+
+/* Write the "ota" member of /status, also the /update response */
+int ota_status_json(char *buf, size_t len)
+{
+    int64_t const elapsed = ota_stats.elapsed_us ? ota_stats.elapsed_us :
+                            ota_stats.start ? esp_timer_get_time() - ota_stats.start : 0;
+    int n;
+
+    n = snprintf(buf, len,
+                 "\"ota\":{\"result\":\"%s\",\"bytes\":%u,\"ms\":%lld,\"kbps\":%lld,"
+                 "\"timeouts\":%u,\"timeout_ms\":%lld,\"hist_min_us\":128,",
+                 !ota_stats.start ? "none" : !ota_stats.elapsed_us ? "running" : esp_err_to_name(ota_stats.result),
+                 ota_stats.bytes,
+                 elapsed / 1000, elapsed ? (int64_t) ota_stats.bytes * 8000 / elapsed : 0,
+                 ota_stats.timeouts, ota_stats.timeout_us / 1000);
+    if (n < (int) len)
+        n += ota_timing_json(buf + n, len - n, "recv", &ota_stats.recv);
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n, ",");
+    if (n < (int) len)
+        n += ota_timing_json(buf + n, len - n, "write", &ota_stats.write);
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n, "}");
+    return n;
+}
@@ -0,0 +1,116 @@
+/* Fixed-block buffer pool
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include <esp_log.h>
+
+#include "pool.h"
+
+#define POOL_BLOCKS         CONFIG_WEBKEY_POOL_BLOCKS
+#define POOL_BLOCK_SIZE     CONFIG_WEBKEY_POOL_BLOCK_SIZE
+
+/* Should put these in .h file(s) */
+extern const char *TAG;
+
+typedef struct
+{
+    uint32_t in_use;            // Blocks held now
+    uint32_t peak;              // Most blocks held at once
+    uint32_t gets;              // Successful borrows
+    uint32_t exhausted;         // Borrows refused because the pool was empty
+} pool_account_t;
+
+static const char *const pool_owner_names[POOL_OWNER_COUNT] = {
+    "flush", "config", "ota", "status", "type",
+};
+
+/* Local storage */
+static uint8_t pool_blocks[POOL_BLOCKS][POOL_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint8_t pool_owner[POOL_BLOCKS];
+static uint32_t pool_free = (1u << POOL_BLOCKS) - 1;   // Bit per free block
+static uint32_t pool_low_water = POOL_BLOCKS;
+static pool_account_t pool_accounts[POOL_OWNER_COUNT];
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert(POOL_BLOCKS <= 31, "pool free mask is 32 bits");
+
+void *pool_get(pool_owner_t owner)
+{
+    pool_account_t *acct = &pool_accounts[owner];
+    int i = -1;
+
+    portENTER_CRITICAL(&pool_lock);
+    if (pool_free != 0) {
+        i = __builtin_ctz(pool_free);
+        pool_free &= ~(1u << i);
+        pool_owner[i] = owner;
+        acct->gets++;
+        if (++acct->in_use > acct->peak)
+            acct->peak = acct->in_use;
+        if ((uint32_t) __builtin_popcount(pool_free) < pool_low_water)
+            pool_low_water = __builtin_popcount(pool_free);
+    } else {
+        acct->exhausted++;
+    }
+    portEXIT_CRITICAL(&pool_lock);
+
+    if (i < 0) {
+        ESP_LOGW(TAG, "Buffer pool exhausted (%s)", pool_owner_names[owner]);
+        return NULL;
+    }
+    return pool_blocks[i];
+}
+
+void pool_put(void *block)
+{
+    int i;
+
+    if (block == NULL)
+        return;
+    i = ((uint8_t *) block - &pool_blocks[0][0]) / POOL_BLOCK_SIZE;
+    configASSERT((i >= 0) && (i < POOL_BLOCKS) && (block == pool_blocks[i]));
+
+    portENTER_CRITICAL(&pool_lock);
+    configASSERT((pool_free & (1u << i)) == 0);
+    pool_free |= 1u << i;
+    pool_accounts[pool_owner[i]].in_use--;
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+size_t pool_block_size(void)
+{
+    return POOL_BLOCK_SIZE;
+}
+
+int pool_status_json(char *buf, size_t len)
+{
+    pool_account_t accts[POOL_OWNER_COUNT];
+    uint32_t free_mask, low_water;
+    int n;
+
+    portENTER_CRITICAL(&pool_lock);
+    memcpy(accts, pool_accounts, sizeof(accts));
+    free_mask = pool_free;
+    low_water = pool_low_water;
+    portEXIT_CRITICAL(&pool_lock);
+
+    n = snprintf(buf, len, "\"pool\":{\"blocks\":%d,\"block_size\":%d,\"free\":%d,\"low_water\":%u,\"owners\":{",
+                 POOL_BLOCKS, POOL_BLOCK_SIZE, __builtin_popcount(free_mask), low_water);
+    for (int i = 0; (i < POOL_OWNER_COUNT) && (n < (int) len); i++) {
+        n += snprintf(buf + n, len - n, "%s\"%s\":{\"in_use\":%u,\"peak\":%u,\"gets\":%u,\"exhausted\":%u}",
+                      i ? "," : "", pool_owner_names[i],
+                      accts[i].in_use, accts[i].peak, accts[i].gets, accts[i].exhausted);
+    }
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n, "}}");
+    return n;
+}
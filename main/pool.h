@@ -0,0 +1,41 @@
+/* Fixed-block buffer pool
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+
+/* Request handlers borrow their working buffers from a static set of equal
+ * sized blocks (WEBKEY_POOL_BLOCKS x WEBKEY_POOL_BLOCK_SIZE) instead of the
+ * heap or large stack arrays. Use is accounted per owner for /status. */
+
+typedef enum
+{
+    POOL_OWNER_FLUSH = 0,       // Reading signed request bodies for their hash
+    POOL_OWNER_CONFIG,          // Configuration form
+    POOL_OWNER_OTA,             // Firmware upload chunks
+    POOL_OWNER_STATUS,          // Status JSON
+    POOL_OWNER_TYPE,            // Text to type
+    POOL_OWNER_COUNT
+} pool_owner_t;
+
+/* Borrow a block, NULL when all are in use (never waits) */
+void *pool_get(pool_owner_t owner);
+
+/* Return a block from pool_get, NULL is ignored */
+void pool_put(void *block);
+
+/* Usable bytes in every block */
+size_t pool_block_size(void);
+
+/* Write the "pool" member of /status */
+int pool_status_json(char *buf, size_t len);
+
+#endif /* POOL_H_ */
@@ -0,0 +1,59 @@
+/* Binary event trace
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <string.h>
+#include "esp_timer.h"
+
+#include "trace.h"
+
+/* Power of two so the index wraps with a mask */
+#define TRACE_RECORDS       (1 << CONFIG_WEBKEY_TRACE_ORDER)
+
+/* Local storage */
+static trace_record_t trace_ring[TRACE_RECORDS];
+static uint32_t trace_next = 0;
+
+/* Writers claim a slot with one atomic add and never wait on each other.
+ * The id is stored last so a reader can tell a slot that is being filled. */
+void trace(uint16_t id, uint16_t a0, uint32_t a1, uint32_t a2)
+{
+    uint32_t const index = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+    trace_record_t *rec = &trace_ring[index & (TRACE_RECORDS - 1)];
+
+    __atomic_store_n(&rec->id, TRACE_NONE, __ATOMIC_RELAXED);
+    rec->time = (uint32_t) esp_timer_get_time();
+    rec->a0 = a0;
+    rec->a1 = a1;
+    rec->a2 = a2;
+    __atomic_store_n(&rec->id, id, __ATOMIC_RELEASE);
+}
+
+uint32_t trace_head(void)
+{
+    return __atomic_load_n(&trace_next, __ATOMIC_ACQUIRE);
+}
+
+uint32_t trace_capacity(void)
+{
+    return TRACE_RECORDS;
+}
+
+int trace_get(uint32_t index, trace_record_t *rec)
+{
+    const trace_record_t *slot = &trace_ring[index & (TRACE_RECORDS - 1)];
+
+    if (trace_head() - index > TRACE_RECORDS)
+        return 0;
+    if (__atomic_load_n(&slot->id, __ATOMIC_ACQUIRE) == TRACE_NONE)
+        return 0;
+    memcpy(rec, slot, sizeof(*rec));
+
+    /* Overwritten while copying */
+    return trace_head() - index <= TRACE_RECORDS;
+}
@@ -0,0 +1,83 @@
+/* Binary event trace
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+/* Fixed-size records written to a RAM ring without locks and formatted only
+ * when read, by tools/webkey_trace.py from GET /trace. The tool takes event
+ * names and formats from this file, so keep one "= value, // format" entry
+ * per line. */
+
+typedef enum
+{
+  TRACE_NONE          = 0,
+  TRACE_HTTP_POST     = 1,      // uri=%uri len=%a1
+  TRACE_HTTP_RECV     = 2,      // got=%a1 remaining=%a2
+  TRACE_HTTP_RESP     = 3,      // uri=%uri result=%a1
+  TRACE_HID_EVENT     = 4,      // %hidev arg=%a1
+  TRACE_HID_REPORT    = 5,      // mod=%a0 key=%a1 key2=%a2
+  TRACE_HID_SEQ_START = 6,      // btn=%a0 mode=%a1
+  TRACE_HID_SEQ_END   = 7,      // btn=%a0 result=%a1 ms=%a2
+  TRACE_CTRL_UDP      = 8,      // cmd=%a0 status=%a1 seq=%a2
+  TRACE_HTTP_AUTH     = 9,      // uri=%uri why=%a1 ts=%a2 (0 bad mac, else auth_fresh_t)
+  TRACE_HID_CONTROL   = 10,     // report=%a0 usage=%a1
+} trace_id_t;
+
+/* URI codes for HTTP records */
+typedef enum
+{
+  TRACE_URI_OTHER     = 0,
+  TRACE_URI_CTRL      = 1,
+  TRACE_URI_ARM       = 2,
+  TRACE_URI_CONFIG    = 3,
+  TRACE_URI_UPDATE    = 4,
+  TRACE_URI_TYPE      = 5,
+  TRACE_URI_POWER     = 6,
+  TRACE_URI_CONSUMER  = 7,
+} trace_uri_t;
+
+typedef struct
+{
+  uint32_t time;                // esp_timer, us (wraps after 71 minutes)
+  uint16_t id;                  // trace_id_t
+  uint16_t a0;
+  uint32_t a1;
+  uint32_t a2;
+} trace_record_t;
+
+/* Download header, followed by 'count' records oldest first */
+typedef struct
+{
+  uint32_t magic;               // TRACE_MAGIC
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t count;
+  uint32_t head;                // Total records ever written
+  uint32_t now;                 // esp_timer at download, us
+} trace_header_t;
+
+#define TRACE_MAGIC         0x52544B57      // "WKTR"
+#define TRACE_VERSION       1
+
+/* Append a record, safe from any task or ISR */
+void trace(uint16_t id, uint16_t a0, uint32_t a1, uint32_t a2);
+
+/* Total records written so far */
+uint32_t trace_head(void);
+
+/* Copy record number 'index', false if it has been overwritten */
+int trace_get(uint32_t index, trace_record_t *rec);
+
+/* Ring capacity in records */
+uint32_t trace_capacity(void);
+
+#endif /* TRACE_H_ */
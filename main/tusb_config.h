@@ -26,6 +26,8 @@
 #ifndef _TUSB_CONFIG_H_
 #define _TUSB_CONFIG_H_
 
+#include "sdkconfig.h"
+
 #ifdef __cplusplus
  extern "C" {
 #endif
@@ -94,15 +96,30 @@
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID               1
+#if CONFIG_WEBKEY_USB_MOUSE && CONFIG_WEBKEY_USB_CONTROL
+#define CFG_TUD_HID               3   // Boot keyboard + mouse + system/consumer control
+#elif CONFIG_WEBKEY_USB_MOUSE || CONFIG_WEBKEY_USB_CONTROL
+#define CFG_TUD_HID               2   // Boot keyboard + one of them
+#else
+#define CFG_TUD_HID               1   // Boot keyboard
+#endif
 #define CFG_TUD_CDC               0
 #define CFG_TUD_MSC               0
 #define CFG_TUD_MIDI              0
 #define CFG_TUD_VENDOR            0
+#if CONFIG_WEBKEY_USB_NET
+#define CFG_TUD_NET               1   // CDC-ECM next to the keyboard
+#else
+#define CFG_TUD_NET               0
+#endif
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_EP_BUFSIZE    16
 
+// Full speed bulk endpoints, frames up to a standard Ethernet MTU
+#define CFG_TUD_NET_ENDPOINT_SIZE 64
+#define CFG_TUD_NET_MTU           1514
+
 #ifdef __cplusplus
  }
 #endif
@@ -23,18 +23,31 @@
  *
  */
 
+#include <stdio.h>
+
 #include "tusb.h"
 #include "usb_descriptors.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
+ * CFG_TUD_HID only counts the HID interfaces, so each optional one gets a bit of its own.
  *
  * Auto ProductID layout's Bitmap:
- *   [MSB]         HID | MSC | CDC          [LSB]
+ *   [MSB]  CONTROL | MOUSE | NET | VENDOR | MIDI | HID | MSC | CDC  [LSB]
  */
 #define _PID_MAP(itf, n)  ( (CFG_TUD_##itf) << (n) )
-#define USB_PID           (0x4000 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) | _PID_MAP(HID, 2) | \
-                           _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) )
+#if CONFIG_WEBKEY_USB_MOUSE
+#define _PID_MOUSE        (1 << 6)
+#else
+#define _PID_MOUSE        0
+#endif
+#if CONFIG_WEBKEY_USB_CONTROL
+#define _PID_CONTROL      (1 << 7)
+#else
+#define _PID_CONTROL      0
+#endif
+#define USB_PID           (0x4000 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) | ((CFG_TUD_HID ? 1 : 0) << 2) | \
+                           _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) | _PID_MAP(NET, 5) | _PID_MOUSE | _PID_CONTROL )
 
 //--------------------------------------------------------------------+
 // Device Descriptors
@@ -44,18 +57,25 @@ tusb_desc_device_t const desc_device =
     .bLength            = sizeof(tusb_desc_device_t),
     .bDescriptorType    = TUSB_DESC_DEVICE,
     .bcdUSB             = 0x0200,
+#if CFG_TUD_NET
+    // The network function is grouped by an Interface Association
+    .bDeviceClass       = TUSB_CLASS_MISC,
+    .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol    = MISC_PROTOCOL_IAD,
+#else
     .bDeviceClass       = 0x00,
     .bDeviceSubClass    = 0x00,
     .bDeviceProtocol    = 0x00,
+#endif
     .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
 
     .idVendor           = 0xCafe,
     .idProduct          = USB_PID,
     .bcdDevice          = 0x0100,
 
-    .iManufacturer      = 0x01,
-    .iProduct           = 0x02,
-    .iSerialNumber      = 0x03,
+    .iManufacturer      = STRID_MANUFACTURER,
+    .iProduct           = STRID_PRODUCT,
+    .iSerialNumber      = STRID_SERIAL,
 
     .bNumConfigurations = 0x01
 };
@@ -71,33 +91,59 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-uint8_t const desc_hid_report[] =
+// Boot keyboard, no report ID so reports are identical in boot and report protocol
+uint8_t const desc_hid_keyboard_report[] =
+{
+  TUD_HID_REPORT_DESC_KEYBOARD()
+};
+
+#if CONFIG_WEBKEY_USB_MOUSE
+uint8_t const desc_hid_mouse_report[] =
+{
+  TUD_HID_REPORT_DESC_MOUSE( HID_REPORT_ID(REPORT_ID_MOUSE) )
+};
+#endif
+
+#if CONFIG_WEBKEY_USB_CONTROL
+uint8_t const desc_hid_control_report[] =
 {
-  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD) ),
-  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE) )
+  TUD_HID_REPORT_DESC_SYSTEM_CONTROL( HID_REPORT_ID(REPORT_ID_SYSTEM_CONTROL) ),
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL) )
 };
+#endif
 
 // Invoked when received GET HID REPORT DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
-uint8_t const * tud_hid_descriptor_report_cb(void)
+uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 {
-  return desc_hid_report;
+#if CONFIG_WEBKEY_USB_MOUSE
+  if ( instance == ITF_NUM_MOUSE ) return desc_hid_mouse_report;
+#endif
+#if CONFIG_WEBKEY_USB_CONTROL
+  if ( instance == ITF_NUM_CONTROL ) return desc_hid_control_report;
+#endif
+  (void) instance;
+  return desc_hid_keyboard_report;
 }
 
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
-enum
-{
-  ITF_NUM_HID,
-  ITF_NUM_TOTAL
-};
-
-#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#if CFG_TUD_NET
+#define  NET_DESC_LEN      TUD_CDC_ECM_DESC_LEN
+#else
+#define  NET_DESC_LEN      0
+#endif
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + CFG_TUD_HID*TUD_HID_DESC_LEN + NET_DESC_LEN)
 
-#define EPNUM_HID   0x81
+#define EPNUM_KEYBOARD  0x81
+#define EPNUM_MOUSE     0x82
+#define EPNUM_NET_NOTIF 0x83
+#define EPNUM_NET_OUT   0x04
+#define EPNUM_NET_IN    0x84
+#define EPNUM_CONTROL   0x85
 
 uint8_t const desc_configuration[] =
 {
@@ -105,7 +151,18 @@ uint8_t const desc_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In & Out address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, 1, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 10)
+  // Keyboard is polled every 1ms so boot menus see every keystroke at full rate
+  TUD_HID_DESCRIPTOR(ITF_NUM_KEYBOARD, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_keyboard_report), EPNUM_KEYBOARD, CFG_TUD_HID_EP_BUFSIZE, 1),
+#if CONFIG_WEBKEY_USB_MOUSE
+  TUD_HID_DESCRIPTOR(ITF_NUM_MOUSE, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_mouse_report), EPNUM_MOUSE, CFG_TUD_HID_EP_BUFSIZE, 10),
+#endif
+#if CONFIG_WEBKEY_USB_CONTROL
+  TUD_HID_DESCRIPTOR(ITF_NUM_CONTROL, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_control_report), EPNUM_CONTROL, CFG_TUD_HID_EP_BUFSIZE, 10),
+#endif
+#if CFG_TUD_NET
+  // Interface number, description string index, MAC address string index, EP notification address and size, EP data address (out, in), and size, max segment size
+  TUD_CDC_ECM_DESCRIPTOR(ITF_NUM_NET, STRID_NET, STRID_MAC, EPNUM_NET_NOTIF, 64, EPNUM_NET_OUT, EPNUM_NET_IN, CFG_TUD_NET_ENDPOINT_SIZE, CFG_TUD_NET_MTU),
+#endif
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
@@ -128,6 +185,10 @@ char const* string_desc_arr [] =
   "TinyUSB",                     // 1: Manufacturer
   "TinyUSB Device",              // 2: Product
   "123456",                      // 3: Serials, should use chip ID
+#if CFG_TUD_NET
+  "WebKey Network",              // 4: Network interface
+  NULL,                          // 5: MAC address, from tud_network_mac_address
+#endif
 };
 
 static uint16_t _desc_str[32];
@@ -152,6 +213,18 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
     if ( !(index < sizeof(string_desc_arr)/sizeof(string_desc_arr[0])) ) return NULL;
 
     const char* str = string_desc_arr[index];
+#if CFG_TUD_NET
+    // The host's MAC address for the link as 12 hex digits
+    char mac_str[13];
+    if ( index == STRID_MAC )
+    {
+      for(uint8_t i=0; i<sizeof(tud_network_mac_address); i++)
+      {
+        sprintf(&mac_str[2*i], "%02X", tud_network_mac_address[i]);
+      }
+      str = mac_str;
+    }
+#endif
 
     // Cap at max char
     chr_count = strlen(str);
@@ -25,10 +25,56 @@
 #ifndef USB_DESCRIPTORS_H_
 #define USB_DESCRIPTORS_H_
 
+#include "sdkconfig.h"
+
+// HID interfaces, numbered in the same order as the HID instances.
+// The keyboard is a boot-subclass interface of its own so that BIOS
+// boot-protocol hosts see it, it uses no report ID. The network
+// interfaces come after all HID ones so the numbering still holds.
+enum
+{
+  ITF_NUM_KEYBOARD = 0,
+#if CONFIG_WEBKEY_USB_MOUSE
+  ITF_NUM_MOUSE,
+#endif
+#if CONFIG_WEBKEY_USB_CONTROL
+  ITF_NUM_CONTROL,
+#endif
+#if CONFIG_WEBKEY_USB_NET
+  ITF_NUM_NET,
+  ITF_NUM_NET_DATA,
+#endif
+  ITF_NUM_TOTAL
+};
+
+// String descriptor indexes
+enum
+{
+  STRID_LANGID = 0,
+  STRID_MANUFACTURER,
+  STRID_PRODUCT,
+  STRID_SERIAL,
+#if CONFIG_WEBKEY_USB_NET
+  STRID_NET,
+  STRID_MAC,
+#endif
+};
+
+#if CONFIG_WEBKEY_USB_MOUSE
+// Report IDs on the mouse interface
+enum
+{
+  REPORT_ID_MOUSE = 1
+};
+#endif
+
+#if CONFIG_WEBKEY_USB_CONTROL
+// Report IDs on the control interface
 enum
 {
-  REPORT_ID_KEYBOARD = 1,
-  REPORT_ID_MOUSE
+  REPORT_ID_SYSTEM_CONTROL = 1,   // 1 byte: 1 power down, 2 sleep, 3 wake up, 0 none
+  REPORT_ID_CONSUMER_CONTROL,     // 2 bytes: consumer page usage, 0 none
 };
+#endif
 
 #endif /* USB_DESCRIPTORS_H_ */
@@ -37,6 +37,8 @@
 #include "tusb.h"
 
 #include "usb_descriptors.h"
+#include "hid_task.h"
+#include "usb_net.h"
 
 #include "esp_rom_gpio.h"
 #include "hal/gpio_ll.h"
@@ -55,13 +57,7 @@
 StackType_t  usb_device_stack[USBD_STACK_SIZE];
 StaticTask_t usb_device_taskdef;
 
-// static task for hid
-#define HID_STACK_SIZE      (2*configMINIMAL_STACK_SIZE)
-StackType_t  hid_stack[HID_STACK_SIZE];
-StaticTask_t hid_taskdef;
-
 void usb_device_task(void* param);
-void hid_task(void* params);
 
 extern const char *TAG;
 
@@ -107,11 +103,13 @@ void usb_init(void)
   usb_hal_init(&hal);
   configure_pins(&hal);
 
+#if CONFIG_WEBKEY_USB_NET
+  // Network interface must exist before the host can configure it
+  usb_net_init();
+#endif
+
   // Create a task for tinyusb device stack
   (void) xTaskCreateStatic( usb_device_task, "usbd", USBD_STACK_SIZE, NULL, configMAX_PRIORITIES-1, usb_device_stack, &usb_device_taskdef);
-
-  // Create HID task
-  (void) xTaskCreateStatic( hid_task, "hid", HID_STACK_SIZE, NULL, configMAX_PRIORITIES-2, hid_stack, &hid_taskdef);
 }
 
 // USB Device Driver task
@@ -131,98 +129,3 @@ void usb_device_task(void* param)
     tud_task();
   }
 }
-
-//--------------------------------------------------------------------+
-// USB HID
-//--------------------------------------------------------------------+
-uint32_t button_pressed = 0;
-
-void hid_task(void* param)
-{
-  uint8_t sequence;
-  uint8_t key_active;
-  (void) param;
-
-  while(1)
-  {
-    // Poll every 100ms
-    vTaskDelay(pdMS_TO_TICKS(100));
-
-    // Wait for command from web
-    if ( button_pressed ) {
-        // Record command so user can't change it mid-stream
-        uint32_t const btn = button_pressed;
-
-        // Send key sequence
-        //     30 spaces (halts grub autoboot)
-        //     n down arrows corresponding to button number
-        //     ENTER to start boot
-        sequence = 33;
-        key_active = 0;
-        for(int i=0;(i < 6000) && (sequence != 0);i++) {
-            if ( tud_suspended() ) {
-                // Wake up host if we are in suspend mode
-                // and REMOTE_WAKEUP feature is enabled by host
-                tud_remote_wakeup();
-            }
-            if ( tud_hid_boot_mode() ) {
-            }
-
-            // Send next keypress in sequence
-            if ( tud_hid_ready() ) {
-                if ( key_active == 0 ) {
-                    uint8_t keycode[6] = { 0 };
-                    if ( sequence == 1 ) {
-                        keycode[0] = HID_KEY_RETURN;
-                    } else if ( sequence <= btn ) {
-                        keycode[0] = HID_KEY_ARROW_DOWN;
-                    } else {
-                        keycode[0] = HID_KEY_SPACE;
-                    }
-                    tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, keycode);
-                    key_active = 1;
-                    vTaskDelay(pdMS_TO_TICKS(10));
-                } else {
-                    tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, NULL);
-                    sequence = sequence - 1;
-                    key_active = 0;
-                    vTaskDelay(pdMS_TO_TICKS(500));
-                }
-            } else {
-                vTaskDelay(pdMS_TO_TICKS(10));
-            }
-        }
-        if (sequence != 0)
-            printf("Timeout before sequence ended\n");
-
-        // Clear command and discard any that occurred during execution
-        button_pressed = 0;
-    }
-  }
-}
-
-// Invoked when received GET_REPORT control request
-// Application must fill buffer report's content and return its length.
-// Return zero will cause the stack to STALL request
-uint16_t tud_hid_get_report_cb(uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
-{
-  // TODO not Implemented
-  (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) reqlen;
-
-  return 0;
-}
-
-// Invoked when received SET_REPORT control request or
-// received data on OUT endpoint ( Report ID = 0, Type = 0 )
-void tud_hid_set_report_cb(uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
-{
-  // TODO set LED based on CAPLOCK, NUMLOCK etc...
-  (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) bufsize;
-}
-
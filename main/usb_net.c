@@ -0,0 +1,182 @@
+/* USB network interface
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include "sdkconfig.h"
+
+#if CONFIG_WEBKEY_USB_NET
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "tusb.h"
+
+#include "esp_log.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/etharp.h"
+#include "lwip/tcpip.h"
+#include "lwip/ip4_addr.h"
+#include "dhcpserver/dhcpserver.h"
+#include "dhcpserver/dhcpserver_options.h"
+
+#include "usb_net.h"
+
+extern const char *TAG;
+
+#define USB_NET_XMIT_WAIT_MS  10      // Give the host this long to take a frame
+
+// MAC of the host's end of the link, sent as a string descriptor. Locally
+// administered, the device's own end differs in the last bit.
+const uint8_t tud_network_mac_address[6] = { 0x02, 0x57, 0x4b, 0x45, 0x59, 0x00 };
+
+static struct netif usb_netif;
+static ip4_addr_t usb_net_ip;
+static volatile bool usb_net_up = false;
+static uint32_t usb_net_rx = 0;
+static uint32_t usb_net_tx = 0;
+static uint32_t usb_net_rx_dropped = 0;
+static uint32_t usb_net_tx_dropped = 0;
+
+//--------------------------------------------------------------------+
+// lwIP side, runs in the TCP/IP task
+//--------------------------------------------------------------------+
+
+// Send one frame, waits briefly for the endpoint but never for a host
+// that is not there
+static err_t usb_net_linkoutput(struct netif *netif, struct pbuf *p)
+{
+  (void) netif;
+
+  for (int i = 0; !tud_network_can_xmit(); i++) {
+    if ( !usb_net_up || !tud_ready() || (i >= USB_NET_XMIT_WAIT_MS) ) {
+      usb_net_tx_dropped++;
+      return ERR_IF;
+    }
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+  // Copies the frame into the endpoint buffer before returning
+  tud_network_xmit(p, 0);
+  usb_net_tx++;
+  return ERR_OK;
+}
+
+static err_t usb_net_netif_init(struct netif *netif)
+{
+  netif->name[0] = 'u';
+  netif->name[1] = 's';
+  netif->mtu = CFG_TUD_NET_MTU - 14;    // Less the Ethernet header
+  netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP;
+  netif->output = etharp_output;
+  netif->linkoutput = usb_net_linkoutput;
+  netif->hwaddr_len = sizeof(tud_network_mac_address);
+  memcpy(netif->hwaddr, tud_network_mac_address, sizeof(tud_network_mac_address));
+  netif->hwaddr[5] ^= 0x01;
+  return ERR_OK;
+}
+
+static void usb_net_add(void *ctx)
+{
+  ip4_addr_t mask, gw;
+  dhcps_offer_t offer = 0;              // Neither router nor DNS
+
+  IP4_ADDR(&mask, 255, 255, 255, 0);
+  ip4_addr_set_zero(&gw);
+  netif_add(&usb_netif, &usb_net_ip, &mask, &gw, NULL, usb_net_netif_init, tcpip_input);
+  netif_set_up(&usb_netif);
+
+  dhcps_set_option_info(ROUTER_SOLICITATION_ADDRESS, &offer, sizeof(offer));
+  dhcps_set_option_info(DOMAIN_NAME_SERVER, &offer, sizeof(offer));
+  dhcps_start(&usb_netif, usb_net_ip);
+  *(volatile bool *) ctx = true;
+}
+
+static void usb_net_link(void *ctx)
+{
+  if ( ctx ) {
+    netif_set_link_up(&usb_netif);
+  } else {
+    netif_set_link_down(&usb_netif);
+  }
+}
+
+void usb_net_init(void)
+{
+  volatile bool added = false;
+
+  if ( !ip4addr_aton(CONFIG_WEBKEY_USB_NET_IP, &usb_net_ip) ) {
+    ESP_LOGE(TAG, "Bad USB network address %s", CONFIG_WEBKEY_USB_NET_IP);
+    return;
+  }
+  if ( (tcpip_callback(usb_net_add, (void *) &added) != ERR_OK) ) {
+    ESP_LOGE(TAG, "USB network not started");
+    return;
+  }
+  while ( !added ) vTaskDelay(1);
+  ESP_LOGI(TAG, "USB network at %s", CONFIG_WEBKEY_USB_NET_IP);
+}
+
+int usb_net_status_json(char *buf, size_t len)
+{
+  return snprintf(buf, len,
+                  "\"usb_net\":{\"ip\":\"%s\",\"up\":%s,\"rx\":%u,\"tx\":%u,\"rx_dropped\":%u,\"tx_dropped\":%u}",
+                  CONFIG_WEBKEY_USB_NET_IP, usb_net_up ? "true" : "false",
+                  usb_net_rx, usb_net_tx, usb_net_rx_dropped, usb_net_tx_dropped);
+}
+
+//--------------------------------------------------------------------+
+// TinyUSB side, runs in the USB task and must not wait on lwIP
+//--------------------------------------------------------------------+
+
+// Invoked when the host selects the data interface, and on bus reset
+void tud_network_init_cb(void)
+{
+  usb_net_up = true;
+  if ( tcpip_try_callback(usb_net_link, (void *) 1) != ERR_OK ) {
+    ESP_LOGE(TAG, "USB network link not raised");
+  }
+}
+
+// Frame from the host, copied out so the endpoint can be re-armed at once
+bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
+{
+  struct pbuf *p = usb_netif.input ? pbuf_alloc(PBUF_RAW, size, PBUF_POOL) : NULL;
+
+  if ( p != NULL ) {
+    pbuf_take(p, src, size);
+    if ( usb_netif.input(p, &usb_netif) == ERR_OK ) {
+      usb_net_rx++;
+    } else {
+      pbuf_free(p);
+      p = NULL;
+    }
+  }
+  if ( p == NULL ) usb_net_rx_dropped++;
+  tud_network_recv_renew();
+  return true;
+}
+
+// Copy the pbuf passed to tud_network_xmit into the endpoint buffer
+uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg)
+{
+  struct pbuf *p = (struct pbuf *) ref;
+
+  (void) arg;
+  return pbuf_copy_partial(p, dst, p->tot_len, 0);
+}
+
+void usb_net_umount(void)
+{
+  usb_net_up = false;
+  (void) tcpip_try_callback(usb_net_link, NULL);
+}
+
+#endif /* CONFIG_WEBKEY_USB_NET */
@@ -0,0 +1,32 @@
+/* USB network interface
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef USB_NET_H_
+#define USB_NET_H_
+
+#include <stddef.h>
+
+/* With WEBKEY_USB_NET the device adds a CDC-ECM network interface next to the
+ * keyboard. It has a fixed address (WEBKEY_USB_NET_IP, /24) on its own lwIP
+ * netif and hands the host the next address by DHCP, without a router or
+ * DNS so the host keeps its own default route. The web server and the UDP
+ * control port listen on every interface, so the whole control API is
+ * reachable over the cable whatever the state of WiFi. */
+
+/* Add the netif and DHCP server, call after the TCP/IP stack is up and
+ * before the USB task starts */
+void usb_net_init(void);
+
+/* Host gone (unmounted), frames are dropped until it configures us again */
+void usb_net_umount(void);
+
+/* Write the "usb_net" member of /status */
+int usb_net_status_json(char *buf, size_t len);
+
+#endif /* USB_NET_H_ */
@@ -13,20 +13,195 @@
 #include <esp_system.h>
 #include <nvs_flash.h>
 #include <sys/param.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include "nvs_flash.h"
 #include "esp_netif.h"
 #include "esp_eth.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
 
 #include <esp_http_server.h>
+#include "mbedtls/sha256.h"
+#if CONFIG_WEBKEY_HTTPS
+#include <esp_https_server.h>
+#endif
+
+#include "hid_task.h"
+#include "macro.h"
+#include "keymap.h"
+#include "leadin.h"
+#include "auth.h"
+#include "trace.h"
+#include "pool.h"
+#include "wifi_aps.h"
+#include "wifi_ps.h"
+#include "usb_net.h"
+#include "audit.h"
+#include "ctrl_proto.h"
 
 /* Should put these in .h file(s) */
 extern const char *TAG;
 
-int32_t web_server_down = 0;
+#if CONFIG_WEBKEY_HTTPS
+static httpd_handle_t secure_server = NULL;
+
+/* Configuration and firmware only travel over TLS */
+static bool https_required(httpd_req_t *req)
+{
+    return req->handle != secure_server;
+}
+
+/* Send a plain-HTTP page request to the same path on HTTPS */
+static esp_err_t https_redirect(httpd_req_t *req)
+{
+    char host[64], location[64 + 16 + CONFIG_HTTPD_MAX_URI_LEN];
+
+    if (httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Use https");
+        return ESP_FAIL;
+    }
+    strtok(host, ":");  // Drop the plain port
+    snprintf(location, sizeof(location), "https://%s%s", host, req->uri);
+    httpd_resp_set_status(req, "307 Temporary Redirect");
+    httpd_resp_set_hdr(req, "Location", location);
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+}
+#endif
 
 esp_err_t ota_init(void);
 esp_err_t ota_write(char *, int);
 esp_err_t ota_finish(esp_err_t);
+void ota_recv_time(int64_t, int);
+int ota_status_json(char *, size_t);
+int wifi_status_json(char *, size_t);
+
+/* The servers keep running while WiFi is down, they listen on every
+ * interface so the same sockets serve again once the link is back. Plain
+ * HTTP connections are tracked by local address so the ones left on an
+ * address the station no longer has can be closed; TLS sessions (whose open
+ * and close hooks belong to esp_https_server) are left to the LRU purge. */
+#define HTTP_MAX_SOCKETS    7           // HTTPD_DEFAULT_CONFIG
+#define HTTPS_MAX_SOCKETS   3           // Each TLS session holds its own buffers
+
+/* Every lwIP socket the firmware holds at once: each server's sessions
+ * plus its listen and control sockets, and the UDP control port. httpd
+ * only checks each server against CONFIG_LWIP_MAX_SOCKETS on its own, so
+ * with HTTPS on the accepts of one would fail once the other is busy. */
+#if CONFIG_WEBKEY_HTTPS
+#define HTTPS_SOCKETS       (HTTPS_MAX_SOCKETS + 2)
+#else
+#define HTTPS_SOCKETS       0
+#endif
+#define WEBKEY_SOCKETS      ((HTTP_MAX_SOCKETS + 2) + HTTPS_SOCKETS + (CONFIG_WEBKEY_CTRL_PORT ? 1 : 0))
+_Static_assert(WEBKEY_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS, "raise CONFIG_LWIP_MAX_SOCKETS or the session limits");
+
+typedef struct {
+    int fd;                             // -1 when free
+    uint32_t local_ip;                  // network byte order
+} http_conn_t;
+
+static http_conn_t http_conns[HTTP_MAX_SOCKETS] = { [0 ... HTTP_MAX_SOCKETS - 1] = { .fd = -1 } };
+static httpd_handle_t http_server = NULL;
+static uint32_t http_opened = 0;
+static uint32_t http_dead_closed = 0;
+
+/* Link recovery, as seen by the first request served on the station address */
+static volatile uint32_t sta_ip = 0;                // network byte order, 0 while down
+static uint32_t sta_dead_ip = 0;                    // address lost by an IP change
+static int64_t link_lost_time = 0;                  // us
+static int64_t link_back_time = 0;                  // us, got an address again
+static int32_t time_to_serve_ms = -1;               // address back to first request served
+static int32_t outage_ms = -1;                      // link lost to first request served
+static uint32_t link_recoveries = 0;
+
+/* IPv4 address of the local or remote end of a connection, 0 if not IPv4.
+ * The server listens on IPv6, so IPv4 connections show up with v4-mapped
+ * addresses. */
+static uint32_t sock_ip(int fd, bool peer)
+{
+    static const uint8_t v4mapped[12] = { [10] = 0xff, [11] = 0xff };
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    uint32_t ip = 0;
+
+    if ((peer ? getpeername(fd, (struct sockaddr *) &addr, &len) :
+                getsockname(fd, (struct sockaddr *) &addr, &len)) != 0)
+        return 0;
+    if (addr.ss_family == AF_INET) {
+        ip = ((struct sockaddr_in *) &addr)->sin_addr.s_addr;
+    } else if (addr.ss_family == AF_INET6) {
+        const uint8_t *a6 = ((struct sockaddr_in6 *) &addr)->sin6_addr.s6_addr;
+        if (memcmp(a6, v4mapped, sizeof(v4mapped)) == 0)
+            memcpy(&ip, a6 + 12, sizeof(ip));
+    }
+    return ip;
+}
+
+/* Runs in the HTTP server task for every accepted connection */
+static esp_err_t http_open_fn(httpd_handle_t hd, int sockfd)
+{
+    for (int i = 0; i < HTTP_MAX_SOCKETS; i++) {
+        if (http_conns[i].fd < 0) {
+            http_conns[i].fd = sockfd;
+            http_conns[i].local_ip = sock_ip(sockfd, false);
+            break;
+        }
+    }
+    http_opened++;
+    return ESP_OK;
+}
+
+/* Runs in the HTTP server task, the socket must be closed here */
+static void http_close_fn(httpd_handle_t hd, int sockfd)
+{
+    for (int i = 0; i < HTTP_MAX_SOCKETS; i++) {
+        if (http_conns[i].fd == sockfd)
+            http_conns[i].fd = -1;
+    }
+    close(sockfd);
+}
+
+/* Queued to the HTTP server task after the station address changed */
+static void http_close_dead(void *arg)
+{
+    for (int i = 0; i < HTTP_MAX_SOCKETS; i++) {
+        if ((http_conns[i].fd >= 0) && (http_conns[i].local_ip == sta_dead_ip)) {
+            httpd_sess_trigger_close(http_server, http_conns[i].fd);
+            http_dead_closed++;
+        }
+    }
+}
+
+/* Note the first request served on the station address after a reconnect */
+static void http_served(httpd_req_t *req)
+{
+    int64_t now;
+
+    if ((link_back_time == 0) || (sta_ip == 0) || (sock_ip(httpd_req_to_sockfd(req), false) != sta_ip))
+        return;
+    now = esp_timer_get_time();
+    time_to_serve_ms = (now - link_back_time) / 1000;
+    outage_ms = (now - link_lost_time) / 1000;
+    link_recoveries++;
+    link_back_time = 0;
+    ESP_LOGI(TAG, "Serving again %d ms after reconnect, %d ms after link loss", time_to_serve_ms, outage_ms);
+}
+
+/* Write the "http" member of /status */
+static int http_status_json(char *buf, size_t len)
+{
+    int open = 0;
+
+    for (int i = 0; i < HTTP_MAX_SOCKETS; i++)
+        open += (http_conns[i].fd >= 0);
+    return snprintf(buf, len,
+                    "\"http\":{\"open\":%d,\"opened\":%u,\"dead_closed\":%u,\"recoveries\":%u,"
+                    "\"time_to_serve_ms\":%d,\"outage_ms\":%d}",
+                    open, http_opened, http_dead_closed, link_recoveries, time_to_serve_ms, outage_ms);
+}
 
 /* Handler to respond with home page */
 static esp_err_t index_html_get_handler(httpd_req_t *req)
@@ -78,9 +253,155 @@ static esp_err_t config_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/* Status sections, each writes one JSON member */
+typedef int (*status_fn_t)(char *, size_t);
+static const status_fn_t status_fns[] = {
+    hid_status_json,
+    leadin_status_json,
+    wifi_status_json,
+    pool_status_json,
+    ota_status_json,
+    http_status_json,
+    audit_status_json,
+#if CONFIG_WEBKEY_USB_NET
+    usb_net_status_json,
+#endif
+};
+
+/* Respond when no buffer could be borrowed from the pool */
+static esp_err_t pool_busy(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    httpd_resp_send(req, "Busy\n", HTTPD_RESP_USE_STRLEN);
+    return ESP_FAIL;
+}
+
+/* Handler to respond with device status as JSON */
+static esp_err_t status_get_handler(httpd_req_t *req)
+{
+    const size_t len = pool_block_size();
+    char *buf = pool_get(POOL_OWNER_STATUS);
+    int n = 0;
+
+    if (buf == NULL)
+        return pool_busy(req);
+
+    buf[n++] = '{';
+    for (int i = 0; i < sizeof(status_fns) / sizeof(status_fns[0]); i++) {
+        if (i > 0)
+            buf[n++] = ',';
+        n += status_fns[i](buf + n, len - n - 3);
+        n = MIN(n, len - 4);
+    }
+    buf[n++] = '}';
+    buf[n++] = '\n';
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, buf, n);
+    pool_put(buf);
+    return ESP_OK;
+}
+
+/* Handler to respond with the button macros as JSON, the pages build their
+ * buttons and editor from it */
+static esp_err_t macros_get_handler(httpd_req_t *req)
+{
+    const size_t len = pool_block_size();
+    char *buf = pool_get(POOL_OWNER_STATUS);
+    int n;
+
+    if (buf == NULL)
+        return pool_busy(req);
+
+    n = macro_json(buf, len);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_send(req, buf, MIN(n, len - 1));
+    pool_put(buf);
+    return ESP_OK;
+}
+
+/* Handler to download the trace ring, oldest record first */
+static esp_err_t trace_get_handler(httpd_req_t *req)
+{
+    trace_record_t recs[32];
+    uint32_t const head = trace_head();
+    uint32_t index = (head > trace_capacity()) ? head - trace_capacity() : 0;
+    trace_header_t hdr = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .record_size = sizeof(trace_record_t),
+        .count = head - index,
+        .head = head,
+        .now = (uint32_t) esp_timer_get_time(),
+    };
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    if (httpd_resp_send_chunk(req, (const char *) &hdr, sizeof(hdr)) != ESP_OK)
+        return ESP_FAIL;
+
+    /* Records overwritten while sending go out zeroed, the tool skips them */
+    while (index != head) {
+        int n;
+        for (n = 0; (n < sizeof(recs) / sizeof(recs[0])) && (index != head); n++, index++) {
+            if (!trace_get(index, &recs[n]))
+                memset(&recs[n], 0, sizeof(recs[n]));
+        }
+        if (httpd_resp_send_chunk(req, (const char *) recs, n * sizeof(recs[0])) != ESP_OK)
+            return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+#define AUDIT_PAGE_DEFAULT  32
+#define AUDIT_PAGE_MAX      256
+
+/* Handler to page through the audit log as JSON, ?cursor= takes the "next"
+ * of the previous page (0 or absent starts at the oldest record) */
+static esp_err_t audit_get_handler(httpd_req_t *req)
+{
+    audit_record_t recs[8];
+    char query[48], value[12], line[256];
+    uint32_t first, next, cursor = 0;
+    int count = AUDIT_PAGE_DEFAULT;
+    int n, len;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "cursor", value, sizeof(value)) == ESP_OK)
+            cursor = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "count", value, sizeof(value)) == ESP_OK)
+            count = MIN(MAX(atoi(value), 1), AUDIT_PAGE_MAX);
+    }
+
+    audit_range(&first, &next);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    len = snprintf(line, sizeof(line), "{\"first\":%u,\"head\":%u,\"records\":[", first, next);
+    if (httpd_resp_send_chunk(req, line, len) != ESP_OK)
+        return ESP_FAIL;
+
+    /* One chunk per record keeps the buffer small, the page is short */
+    for (bool sep = false; (count > 0) && ((n = audit_read(&cursor, recs, MIN(count, 8))) > 0); count -= n) {
+        for (int i = 0; i < n; i++, sep = true) {
+            line[0] = ',';
+            len = audit_record_json(&recs[i], line + 1, sizeof(line) - 1);
+            if (httpd_resp_send_chunk(req, sep ? line : line + 1, MIN(len, sizeof(line) - 2) + sep) != ESP_OK)
+                return ESP_FAIL;
+        }
+    }
+
+    len = snprintf(line, sizeof(line), "],\"next\":%u}\n", MAX(cursor, first));
+    if (httpd_resp_send_chunk(req, line, len) != ESP_OK)
+        return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 /* Handler to respond to wildcard URI and direct the reponse */
 static esp_err_t get_handler(httpd_req_t *req)
 {
+    http_served(req);
+
     /* Return one of a limited number of supported paths */
     if (strcmp(req->uri, "/") == 0) {
         return root_get_handler(req);
@@ -89,9 +410,21 @@ static esp_err_t get_handler(httpd_req_t *req)
     } else if (strcmp(req->uri, "/favicon.ico") == 0) {
         return favicon_get_handler(req);
     } else if (strcmp(req->uri, "/config.html") == 0) {
+#if CONFIG_WEBKEY_HTTPS
+        if (https_required(req))
+            return https_redirect(req);
+#endif
         return config_html_get_handler(req);
     } else if (strcmp(req->uri, "/config") == 0) {
         return config_get_handler(req);
+    } else if (strcmp(req->uri, "/status") == 0) {
+        return status_get_handler(req);
+    } else if (strcmp(req->uri, "/trace") == 0) {
+        return trace_get_handler(req);
+    } else if (strcmp(req->uri, "/macros") == 0) {
+        return macros_get_handler(req);
+    } else if ((strcmp(req->uri, "/audit") == 0) || (strncmp(req->uri, "/audit?", 7) == 0)) {
+        return audit_get_handler(req);
     }
 
     /* Respond with 404 Not Found */
@@ -107,17 +440,121 @@ static httpd_uri_t uri_get = {
     .user_ctx = NULL
 };
 
-/* Flush posted data */
-static esp_err_t flush_post_data(httpd_req_t *req)
+/* Signed request, checked on mutating endpoints once a device key is set.
+ * The client sends
+ *     X-Webkey-Time:  unix seconds
+ *     X-Webkey-Nonce: 16 hex digits, new for every request
+ *     X-Webkey-Auth:  hex HMAC-SHA256 of "METHOD\nURI\nTIME\nNONCE\nSHA256(body) in hex"
+ * so a request is still a single round trip. */
+typedef struct {
+    bool required;
+    int64_t ts;
+    uint64_t nonce;
+    char ts_str[24];
+    char nonce_str[20];
+    uint8_t mac[AUTH_MAC_LEN];
+    mbedtls_sha256_context body;
+} req_auth_t;
+
+/* Reject a request that failed authentication */
+static esp_err_t req_auth_fail(httpd_req_t *req, const char *why)
+{
+    httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, why);
+    return ESP_FAIL;
+}
+
+/* Read the signature headers and start hashing the body */
+static esp_err_t req_auth_begin(httpd_req_t *req, req_auth_t *ra)
+{
+    char mac_str[2 * AUTH_MAC_LEN + 1];
+    uint8_t nonce[8];
+    char *end;
+
+    ra->required = auth_enabled();
+    if (!ra->required)
+        return ESP_OK;
+
+    if ((httpd_req_get_hdr_value_str(req, "X-Webkey-Time", ra->ts_str, sizeof(ra->ts_str)) != ESP_OK) ||
+        (httpd_req_get_hdr_value_str(req, "X-Webkey-Nonce", ra->nonce_str, sizeof(ra->nonce_str)) != ESP_OK) ||
+        (httpd_req_get_hdr_value_str(req, "X-Webkey-Auth", mac_str, sizeof(mac_str)) != ESP_OK))
+        return req_auth_fail(req, "Signature required");
+
+    ra->ts = strtoll(ra->ts_str, &end, 10);
+    if ((*end != '\0') || !auth_parse_hex(ra->nonce_str, nonce, sizeof(nonce)) ||
+        !auth_parse_hex(mac_str, ra->mac, sizeof(ra->mac)))
+        return req_auth_fail(req, "Bad signature");
+    ra->nonce = 0;
+    for (int i = 0; i < sizeof(nonce); i++)
+        ra->nonce = (ra->nonce << 8) | nonce[i];
+
+    mbedtls_sha256_init(&ra->body);
+    mbedtls_sha256_starts_ret(&ra->body, 0);
+    return ESP_OK;
+}
+
+/* Release the body hash when the request ends before req_auth_finish */
+static void req_auth_abort(req_auth_t *ra)
+{
+    if (ra->required)
+        mbedtls_sha256_free(&ra->body);
+    ra->required = false;
+}
+
+static void req_auth_update(req_auth_t *ra, const void *data, size_t len)
+{
+    if (ra->required)
+        mbedtls_sha256_update_ret(&ra->body, data, len);
+}
+
+/* Check the signature once the body has been read, answers 401 on failure */
+static esp_err_t req_auth_finish(httpd_req_t *req, req_auth_t *ra, trace_uri_t uri)
+{
+    static const char *const reasons[] = { "", "Stale request", "Replayed request", "Too many requests",
+                                           "Request not recorded" };
+    uint8_t digest[32], mac[AUTH_MAC_LEN];
+    char msg[8 + CONFIG_HTTPD_MAX_URI_LEN + sizeof(ra->ts_str) + sizeof(ra->nonce_str) + 2 * sizeof(digest)];
+    auth_fresh_t fresh;
+    int n;
+
+    if (!ra->required)
+        return ESP_OK;
+
+    mbedtls_sha256_finish_ret(&ra->body, digest);
+    mbedtls_sha256_free(&ra->body);
+    n = snprintf(msg, sizeof(msg), "%s\n%s\n%s\n%s\n", http_method_str(req->method),
+                 req->uri, ra->ts_str, ra->nonce_str);
+    for (int i = 0; (i < sizeof(digest)) && (n < (int) sizeof(msg) - 2); i++)
+        n += snprintf(msg + n, sizeof(msg) - n, "%02x", digest[i]);
+
+    auth_hmac(msg, n, mac);
+    if (!auth_equal(mac, ra->mac, sizeof(mac))) {
+        trace(TRACE_HTTP_AUTH, uri, 0, (uint32_t) ra->ts);
+        return req_auth_fail(req, "Bad signature");
+    }
+
+    /* Only authentic requests may take a slot in the nonce cache */
+    fresh = auth_check_fresh(ra->ts, ra->nonce);
+    if (fresh != AUTH_FRESH) {
+        trace(TRACE_HTTP_AUTH, uri, fresh, (uint32_t) ra->ts);
+        if (fresh == AUTH_ERROR) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, reasons[fresh]);
+            return ESP_FAIL;
+        }
+        return req_auth_fail(req, reasons[fresh]);
+    }
+    return ESP_OK;
+}
+
+/* Read posted data into buf, hashing it for the signature check when ra is given */
+static esp_err_t recv_post_chunks(httpd_req_t *req, req_auth_t *ra, char *buf, size_t len)
 {
-    char buf[100];
     int ret, remaining = req->content_len;
 
     // Read any posted data
     while (remaining > 0) {
         /* Read the data for the request */
         if ((ret = httpd_req_recv(req, buf,
-                        MIN(remaining, sizeof(buf)))) <= 0) {
+                        MIN(remaining, len))) <= 0) {
             if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
                 /* Retry receiving if timeout occurred */
                 continue;
@@ -125,107 +562,520 @@ static esp_err_t flush_post_data(httpd_req_t *req)
             return ESP_FAIL;
         }
         remaining -= ret;
-
-        /* Log data received */
-        ESP_LOGI(TAG, "=========== RECEIVED DATA ==========");
-        ESP_LOGI(TAG, "%.*s", ret, buf);
-        ESP_LOGI(TAG, "====================================");
+        trace(TRACE_HTTP_RECV, 0, ret, remaining);
+        if (ra)
+            req_auth_update(ra, buf, ret);
     }
     return ESP_OK;
 }
 
+/* Read and hash a signed body in pool blocks, answers 503 when none is free */
+static esp_err_t recv_post_data(httpd_req_t *req, req_auth_t *ra)
+{
+    char *buf;
+    esp_err_t err;
+
+    if (req->content_len == 0)
+        return ESP_OK;
+    if ((buf = pool_get(POOL_OWNER_FLUSH)) == NULL)
+        return pool_busy(req);
+    err = recv_post_chunks(req, ra, buf, pool_block_size());
+    pool_put(buf);
+    return err;
+}
+
+/* Flush posted data before an error response, needs no pool block so it can't fail for lack of one */
+static esp_err_t flush_post_data(httpd_req_t *req)
+{
+    char buf[100];
+
+    return recv_post_chunks(req, NULL, buf, sizeof(buf));
+}
+
+/* Parse ?key=bN[&wait=led], returns button or 0 if the selection is bad */
+static uint32_t parse_selection(httpd_req_t *req, uint32_t *mode)
+{
+    char query[32];
+    char value[8];
+    uint32_t btn = 0;
+
+    *mode = SEQ_MODE_BLIND;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "key", value, sizeof(value)) == ESP_OK) {
+            if ((value[0] == 'b') && (value[1] >= '1') && (value[1] <= '0' + HID_NUM_BUTTONS) && (value[2] == '\0'))
+                btn = value[1] - '0';
+        }
+        if (httpd_query_key_value(query, "wait", value, sizeof(value)) == ESP_OK) {
+            if (strcmp(value, "led") == 0)
+                *mode = SEQ_MODE_LED;
+            else
+                btn = 0;
+        }
+    }
+    return btn;
+}
+
+/* Queue an audit record for a control request, result is a CTRL_ST_* */
+static void audit_request(httpd_req_t *req, audit_type_t type, uint32_t btn, uint32_t mode,
+                          uint8_t result, bool signed_ok, uint32_t arg)
+{
+    audit_append(&(audit_record_t) {
+        .type = type,
+#if CONFIG_WEBKEY_HTTPS
+        .source = (req->handle == secure_server) ? AUDIT_SRC_HTTPS : AUDIT_SRC_HTTP,
+#else
+        .source = AUDIT_SRC_HTTP,
+#endif
+        .addr = sock_ip(httpd_req_to_sockfd(req), true),
+        .btn = btn,
+        .mode = mode,
+        .result = result,
+        .flags = signed_ok ? AUDIT_F_SIGNED : 0,
+        .arg = arg,
+    });
+}
+
 /* Handler for ctrl POST action */
-extern uint32_t button_pressed;
 static esp_err_t ctrl_post_handler(httpd_req_t *req)
 {
     char *resp;
+    uint32_t btn, mode;
+    req_auth_t ra;
 
-    // Clean up any garbage
-    if (flush_post_data(req) != ESP_OK)
+    // Clean up any garbage, it is still covered by the signature
+    if (req_auth_begin(req, &ra) != ESP_OK) {
+        audit_request(req, AUDIT_CTRL, 0, 0, CTRL_ST_AUTH, false, 0);
+        return ESP_FAIL;
+    }
+    if (recv_post_data(req, &ra) != ESP_OK) {
+        req_auth_abort(&ra);
+        return ESP_FAIL;
+    }
+    if (req_auth_finish(req, &ra, TRACE_URI_CTRL) != ESP_OK) {
+        audit_request(req, AUDIT_CTRL, 0, 0, CTRL_ST_AUTH, false, 0);
+        return ESP_FAIL;
+    }
+
+    btn = parse_selection(req, &mode);
+
+    // Trigger the USB task, the result codes are the same as CTRL_ST_*
+    hid_cmd_result_t const res = hid_command(btn, mode);
+    trace(TRACE_HTTP_RESP, TRACE_URI_CTRL, res, btn);
+    audit_request(req, AUDIT_CTRL, btn, mode, res, ra.required, 0);
+    switch ( res ) {
+    case HID_CMD_OK:
+        resp = "Okay\n";
+        break;
+    case HID_CMD_BUSY:
+        resp = "Busy\n";
+        break;
+    default:
+        resp = "Bad Selection\n";
+        break;
+    }
+
+    // Send response
+    httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+/* Handler for arm POST action, key=off disarms */
+static esp_err_t arm_post_handler(httpd_req_t *req)
+{
+    char *resp;
+    char query[32];
+    char value[8];
+    uint32_t btn, mode;
+    uint8_t status;
+    req_auth_t ra;
+
+    // Clean up any garbage, it is still covered by the signature
+    if (req_auth_begin(req, &ra) != ESP_OK) {
+        audit_request(req, AUDIT_ARM, 0, 0, CTRL_ST_AUTH, false, 0);
+        return ESP_FAIL;
+    }
+    if (recv_post_data(req, &ra) != ESP_OK) {
+        req_auth_abort(&ra);
+        return ESP_FAIL;
+    }
+    if (req_auth_finish(req, &ra, TRACE_URI_ARM) != ESP_OK) {
+        audit_request(req, AUDIT_ARM, 0, 0, CTRL_ST_AUTH, false, 0);
         return ESP_FAIL;
+    }
 
-    // Trigger the USB task
-    if ( button_pressed == 0 ) {
-        if (strcmp(req->uri, "/ctrl?key=b1") == 0) {
-            button_pressed = 1;
-            resp = "Okay\n";
-        } else if (strcmp(req->uri, "/ctrl?key=b2") == 0) {
-            button_pressed = 2;
-            resp = "Okay\n";
-        } else if (strcmp(req->uri, "/ctrl?key=b3") == 0) {
-            button_pressed = 3;
-            resp = "Okay\n";
-        } else if (strcmp(req->uri, "/ctrl?key=b4") == 0) {
-            button_pressed = 4;
-            resp = "Okay\n";
+    btn = parse_selection(req, &mode);
+    if ((httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) &&
+        (httpd_query_key_value(query, "key", value, sizeof(value)) == ESP_OK) &&
+        (strcmp(value, "off") == 0)) {
+        status = (hid_arm(0, SEQ_MODE_BLIND) == ESP_OK) ? CTRL_ST_OK : CTRL_ST_ERROR;
+        resp = (status == CTRL_ST_OK) ? "Disarmed\n" : "Error\n";
+        audit_request(req, AUDIT_DISARM, 0, 0, status, ra.required, 0);
+    } else if ( btn == 0 ) {
+        resp = "Bad Selection\n";
+        audit_request(req, AUDIT_ARM, 0, 0, CTRL_ST_BAD_SELECTION, ra.required, 0);
+    } else {
+        status = (hid_arm(btn, mode) == ESP_OK) ? CTRL_ST_OK : CTRL_ST_ERROR;
+        resp = (status == CTRL_ST_OK) ? "Armed\n" : "Error\n";
+        audit_request(req, AUDIT_ARM, btn, mode, status, ra.required, 0);
+    }
+
+    // Send response
+    httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+#if CONFIG_WEBKEY_USB_CONTROL
+/* Names taken by /power and /consumer, anything else on /consumer is a usage number */
+static const struct { const char *name; uint16_t code; } power_actions[] = {
+    { "off", HID_POWER_OFF }, { "sleep", HID_POWER_SLEEP }, { "wake", HID_POWER_WAKE },
+};
+static const struct { const char *name; uint16_t code; } consumer_usages[] = {
+    { "power", 0x30 },          { "sleep", 0x32 },          { "brightness_up", 0x6F },
+    { "brightness_down", 0x70 }, { "next", 0xB5 },          { "previous", 0xB6 },
+    { "stop", 0xB7 },           { "play_pause", 0xCD },     { "mute", 0xE2 },
+    { "volume_up", 0xE9 },      { "volume_down", 0xEA },
+};
+
+/* Shared by /power and /consumer, the query names the action or usage:
+ *     POST /power?action=wake
+ *     POST /consumer?usage=mute       (or usage=0xE2)
+ * Replies like /ctrl, the report is sent by the HID task. */
+static esp_err_t control_post_handler(httpd_req_t *req, bool power)
+{
+    char query[48], value[24];
+    const char *resp;
+    uint32_t code = 0;
+    audit_type_t const type = power ? AUDIT_POWER : AUDIT_CONSUMER;
+    trace_uri_t const uri = power ? TRACE_URI_POWER : TRACE_URI_CONSUMER;
+    req_auth_t ra;
+
+    if (req_auth_begin(req, &ra) != ESP_OK) {
+        audit_request(req, type, 0, 0, CTRL_ST_AUTH, false, 0);
+        return ESP_FAIL;
+    }
+    if (recv_post_data(req, &ra) != ESP_OK) {
+        req_auth_abort(&ra);
+        return ESP_FAIL;
+    }
+    if (req_auth_finish(req, &ra, uri) != ESP_OK) {
+        audit_request(req, type, 0, 0, CTRL_ST_AUTH, false, 0);
+        return ESP_FAIL;
+    }
+
+    if ((httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) &&
+        (httpd_query_key_value(query, power ? "action" : "usage", value, sizeof(value)) == ESP_OK)) {
+        if (power) {
+            for (int i = 0; i < sizeof(power_actions) / sizeof(power_actions[0]); i++) {
+                if (strcmp(value, power_actions[i].name) == 0)
+                    code = power_actions[i].code;
+            }
         } else {
-            resp = "Bad Selection\n";
+            for (int i = 0; i < sizeof(consumer_usages) / sizeof(consumer_usages[0]); i++) {
+                if (strcmp(value, consumer_usages[i].name) == 0)
+                    code = consumer_usages[i].code;
+            }
+            if ((code == 0) && isdigit((int) value[0]))
+                code = strtoul(value, NULL, 0);
         }
-    } else {
+    }
+
+    // Result codes are the same as CTRL_ST_*
+    hid_cmd_result_t const res = power ? hid_power(code) : hid_consumer(code);
+    trace(TRACE_HTTP_RESP, uri, res, code);
+    audit_request(req, type, 0, power ? code : 0, res, ra.required, power ? 0 : code);
+    switch ( res ) {
+    case HID_CMD_OK:
+        resp = "Okay\n";
+        break;
+    case HID_CMD_BUSY:
         resp = "Busy\n";
+        break;
+    default:
+        resp = "Bad Selection\n";
+        break;
     }
+    httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+#endif
 
-    // Send response
+#define TYPE_GAP_MAX_MS     100
+
+/* Handler for type POST action, the body is the text to type as is:
+ *     POST /type?layout=de&gap=5
+ * layout defaults to us, gap is ms after every report for slow firmware */
+static esp_err_t type_post_handler(httpd_req_t *req)
+{
+    char query[48], value[8], err_msg[64];
+    char *buf, *resp;
+    int layout = KEYMAP_US;
+    uint32_t gap_ms = 0;
+    int ret, got = 0;
+    req_auth_t ra;
+
+    if (req_auth_begin(req, &ra) != ESP_OK) {
+        audit_request(req, AUDIT_TYPE, 0, 0, CTRL_ST_AUTH, false, req->content_len);
+        return ESP_FAIL;
+    }
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "layout", value, sizeof(value)) == ESP_OK)
+            layout = keymap_find(value);
+        if (httpd_query_key_value(query, "gap", value, sizeof(value)) == ESP_OK)
+            gap_ms = MIN(strtoul(value, NULL, 10), TYPE_GAP_MAX_MS);
+    }
+    if (layout < 0) {
+        req_auth_abort(&ra);
+        flush_post_data(req);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown layout");
+        return ESP_FAIL;
+    }
+    if ((req->content_len == 0) || (req->content_len > HID_TYPE_MAX)) {
+        req_auth_abort(&ra);
+        flush_post_data(req);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Text empty or too long");
+        return ESP_FAIL;
+    }
+
+    if ((buf = pool_get(POOL_OWNER_TYPE)) == NULL) {
+        req_auth_abort(&ra);
+        flush_post_data(req);
+        return pool_busy(req);
+    }
+    while (got < req->content_len) {
+        if ((ret = httpd_req_recv(req, buf + got, req->content_len - got)) <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+                continue;
+            req_auth_abort(&ra);
+            pool_put(buf);
+            return ESP_FAIL;
+        }
+        got += ret;
+    }
+
+    req_auth_update(&ra, buf, got);
+    if (req_auth_finish(req, &ra, TRACE_URI_TYPE) != ESP_OK) {
+        audit_request(req, AUDIT_TYPE, 0, layout, CTRL_ST_AUTH, false, got);
+        pool_put(buf);
+        return ESP_FAIL;
+    }
+
+    /* Say which character is the problem, hid_type only says no */
+    for (int i = 0; i < got; i++) {
+        if (keymap_lookup(layout, buf[i]) == NULL) {
+            audit_request(req, AUDIT_TYPE, 0, layout, CTRL_ST_BAD_SELECTION, ra.required, got);
+            pool_put(buf);
+            snprintf(err_msg, sizeof(err_msg), "No key for 0x%02x at %d in layout %s",
+                     (uint8_t) buf[i], i, keymap_name(layout));
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err_msg);
+            return ESP_FAIL;
+        }
+    }
+
+    hid_cmd_result_t const res = hid_type(buf, got, layout, gap_ms);
+    pool_put(buf);
+    trace(TRACE_HTTP_RESP, TRACE_URI_TYPE, res, got);
+    audit_request(req, AUDIT_TYPE, 0, layout, res, ra.required, got);
+    switch ( res ) {
+    case HID_CMD_OK:
+        resp = "Okay\n";
+        break;
+    case HID_CMD_BUSY:
+        resp = "Busy\n";
+        break;
+    default:
+        resp = "Bad Selection\n";
+        break;
+    }
     httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
 }
 
+/* Decode a form value in place, '+' is a space and %XX a byte */
+static char *url_decode(char *str)
+{
+    char *in = str, *out = str;
+
+    while (*in) {
+        if ((in[0] == '%') && isxdigit((int) in[1]) && isxdigit((int) in[2])) {
+            char hex[3] = { in[1], in[2], '\0' };
+            *out++ = strtol(hex, NULL, 16);
+            in += 3;
+        } else if (*in == '+') {
+            *out++ = ' ';
+            in++;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+    return str;
+}
+
 /* Handler for config POST action */
 static esp_err_t config_post_handler(httpd_req_t *req)
 {
-    char buf[120]; // max=10+64 + 10+32 + 1
-    char *token;
-    int ret, remaining = req->content_len;
+    esp_ip4_addr_t addr;
+    char *buf, *token;
+    int ret, got = 0;
+    req_auth_t ra;
+    const char *ap_ssid[WIFI_APS_MAX] = { 0 };
+    const char *ap_pass[WIFI_APS_MAX] = { 0 };
+    bool aps_set = false;
+    macro_src_t macros[HID_NUM_BUTTONS] = { 0 };
+    bool macros_set = false;
+    char macro_err[64] = "";
+
+    if (req_auth_begin(req, &ra) != ESP_OK)
+        return ESP_FAIL;
 
     /* Open NVS */
     nvs_handle_t nvsHandle;
     esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
     if (err != ESP_OK) {
         ESP_LOGI(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        req_auth_abort(&ra);
         flush_post_data(req);
         return ESP_FAIL;
     }
 
-    /* Read SSID/Password */
-    buf[0] = '\0';
-    while (remaining > 0) {
+    /* Read the whole form so no field is split across reads */
+    if ((buf = pool_get(POOL_OWNER_CONFIG)) == NULL) {
+        req_auth_abort(&ra);
+        nvs_close(nvsHandle);
+        return pool_busy(req);
+    }
+    if (req->content_len >= pool_block_size()) {
+        req_auth_abort(&ra);
+        pool_put(buf);
+        nvs_close(nvsHandle);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Form too large");
+        return ESP_FAIL;
+    }
+    while (got < req->content_len) {
         /* Read the data for the request */
-        if ((ret = httpd_req_recv(req, buf,
-                        MIN(remaining, sizeof(buf)-1))) <= 0) {
+        if ((ret = httpd_req_recv(req, buf + got, req->content_len - got)) <= 0) {
             if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
                 /* Retry receiving if timeout occurred */
                 continue;
             }
+            req_auth_abort(&ra);
+            pool_put(buf);
+            nvs_close(nvsHandle);
             return ESP_FAIL;
         }
-        buf[ret] = '\0';
-        remaining -= ret;
+        got += ret;
+        trace(TRACE_HTTP_RECV, 0, ret, req->content_len - got);
+    }
+    buf[got] = '\0';
 
-        /* Parse received data */
-        token = strtok(buf, "&");
-        while( token != NULL ) {
-            if ( strncmp( token, "wifi_ssid=", 10 ) == 0 ) {
-                token += 10;	// Skip key
-                if (( strlen(token) > 0 ) && ( strlen(token) <= 32 )) {
-                    err = nvs_set_str(nvsHandle, "WIFI_SSID", token);
-                    if ( err != ESP_OK ) {
-                        ESP_LOGI(TAG, "Error (%s) writing WiFi SSID to NVS", esp_err_to_name(err));
-                    }
+    req_auth_update(&ra, buf, got);
+    if (req_auth_finish(req, &ra, TRACE_URI_CONFIG) != ESP_OK) {
+        pool_put(buf);
+        nvs_close(nvsHandle);
+        return ESP_FAIL;
+    }
+
+    /* Parse received data */
+    token = strtok(buf, "&");
+    while( token != NULL ) {
+        if ( ( strncmp( token, "wifi_ssid", 9 ) == 0 ) || ( strncmp( token, "wifi_pass", 9 ) == 0 ) ) {
+            /* wifi_ssid_N/wifi_pass_N, in order of preference, plain wifi_ssid/wifi_pass is entry 1 */
+            bool const ssid = ( token[5] == 's' );
+            int const ap = ( token[9] == '_' ) ? atoi( token + 10 ) : 1;
+            char *value = strchr(token, '=');
+            if ( ( value != NULL ) && ( ap >= 1 ) && ( ap <= WIFI_APS_MAX ) ) {
+                value = url_decode(value + 1);
+                if ( ssid ) {
+                    ap_ssid[ap - 1] = value;
+                    aps_set = true;
+                } else if ( strlen(value) > 0 ) {
+                    ap_pass[ap - 1] = value;    // Empty keeps the stored password
+                }
+            }
+        }
+        else if ( strncmp( token, "auth_key=", 9 ) == 0 ) {
+            token += 9;	// Skip key
+            if ( strlen(token) > 0 ) {
+                err = auth_set_key_hex(token);
+                if ( err != ESP_OK ) {
+                    ESP_LOGI(TAG, "Error (%s) setting device key", esp_err_to_name(err));
+                }
+            }
+        }
+        else if ( strncmp( token, "wifi_ps=", 8 ) == 0 ) {
+            token += 8;	// Skip key
+            if ( strlen(token) > 0 ) {
+                err = wifi_ps_set_profile(token);
+                if ( err != ESP_OK ) {
+                    ESP_LOGI(TAG, "Error (%s) setting power save", esp_err_to_name(err));
                 }
             }
-            else if ( strncmp( token, "wifi_pass=", 10 ) == 0 ) {
-                token += 10;	// Skip key
-                if (( strlen(token) > 0 ) && ( strlen(token) <= 64 )) {
-                    err = nvs_set_str(nvsHandle, "WIFI_PASS", token);
-                    if ( err != ESP_OK ) {
-                        ESP_LOGI(TAG, "Error (%s) writing WiFi SSID to NVS", esp_err_to_name(err));
-                    }
+        }
+        else if ( ( strncmp( token, "macro_label_", 12 ) == 0 ) || ( strncmp( token, "macro_keys_", 11 ) == 0 ) ) {
+            bool const label = ( token[6] == 'l' );
+            int const btn = atoi( token + ( label ? 12 : 11 ) );
+            char *value = strchr(token, '=');
+            if ( ( value != NULL ) && ( btn >= 1 ) && ( btn <= HID_NUM_BUTTONS ) ) {
+                value = url_decode(value + 1);
+                if ( label ) {
+                    macros[btn - 1].label = value;
+                } else {
+                    macros[btn - 1].text = value;
                 }
+                macros_set = true;
             }
-            token = strtok(NULL, "&");
+        }
+        else if ( strncmp( token, "ip_mode=", 8 ) == 0 ) {
+            token += 8;	// Skip key
+            if (( strcmp( token, "static" ) == 0 ) || ( strcmp( token, "dhcp" ) == 0 )) {
+                err = nvs_set_u8(nvsHandle, "IP_MODE", token[0] == 's');
+                if ( err != ESP_OK ) {
+                    ESP_LOGI(TAG, "Error (%s) writing IP mode to NVS", esp_err_to_name(err));
+                }
+            }
+        }
+        else if ( ( strncmp( token, "ip_addr=", 8 ) == 0 ) || ( strncmp( token, "ip_mask=", 8 ) == 0 ) ||
+                  ( strncmp( token, "ip_gw=", 6 ) == 0 ) || ( strncmp( token, "ip_dns=", 7 ) == 0 ) ) {
+            const char *key = ( token[3] == 'a' ) ? "IP_ADDR" : ( token[3] == 'm' ) ? "IP_MASK" :
+                              ( token[3] == 'g' ) ? "IP_GW" : "IP_DNS";
+            token = strchr(token, '=') + 1;
+            if ( esp_netif_str_to_ip4( token, &addr ) == ESP_OK ) {
+                err = nvs_set_str(nvsHandle, key, token);
+                if ( err != ESP_OK ) {
+                    ESP_LOGI(TAG, "Error (%s) writing %s to NVS", esp_err_to_name(err), key);
+                }
+            }
+        }
+        token = strtok(NULL, "&");
+    }
+
+    /* Networks are saved as one list, empty SSIDs drop out. Also points into buf. */
+    if ( aps_set ) {
+        const char *ssid[WIFI_APS_MAX], *pass[WIFI_APS_MAX];
+        int count = 0;
+        for (int i = 0; i < WIFI_APS_MAX; i++) {
+            if ( ( ap_ssid[i] != NULL ) && ( strlen(ap_ssid[i]) > 0 ) ) {
+                ssid[count] = ap_ssid[i];
+                pass[count++] = ap_pass[i];
+            }
+        }
+        err = ( count > 0 ) ? wifi_aps_save(ssid, pass, count) : ESP_OK;
+        if ( err != ESP_OK ) {
+            ESP_LOGI(TAG, "Error (%s) writing WiFi networks to NVS", esp_err_to_name(err));
+        }
+    }
+
+    /* Macros are compiled and stored together, they point into buf */
+    if ( macros_set ) {
+        err = macro_save(macros, macro_err, sizeof(macro_err));
+        if ( err != ESP_OK ) {
+            ESP_LOGI(TAG, "Macros not saved: %s", macro_err);
         }
     }
 
+    pool_put(buf);
+
     /* Close NVS */
     err = nvs_commit(nvsHandle);
     if ( err != ESP_OK ) {
@@ -234,61 +1084,140 @@ static esp_err_t config_post_handler(httpd_req_t *req)
     nvs_close(nvsHandle);
 
     // Send response
-    httpd_resp_send(req, "SSID/Password change will take effect on next reboot", HTTPD_RESP_USE_STRLEN);
+    if ( macros_set && ( macro_err[0] != '\0' ) ) {
+        httpd_resp_set_status(req, "400 Bad Request");
+        httpd_resp_sendstr_chunk(req, "Macros not saved: ");
+        httpd_resp_sendstr_chunk(req, macro_err);
+        httpd_resp_sendstr_chunk(req, "\nOther settings will take effect on next reboot");
+        return httpd_resp_sendstr_chunk(req, NULL);
+    }
+    httpd_resp_send(req, macros_set ? "Macros saved, other settings will take effect on next reboot"
+                                    : "Settings will take effect on next reboot", HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
 }
 
 /* Handler for update POST action */
-char bigbuf[4096];
 static esp_err_t update_post_handler(httpd_req_t *req)
 {
-    int ret, remaining = req->content_len;
+    int ret, n, remaining = req->content_len;
+    int64_t start;
+    char *buf;
     esp_err_t err;
+    req_auth_t ra;
+
+    if (req_auth_begin(req, &ra) != ESP_OK)
+        return ESP_FAIL;
+    if ((buf = pool_get(POOL_OWNER_OTA)) == NULL) {
+        req_auth_abort(&ra);
+        return pool_busy(req);
+    }
 
     /* Start OTA process */
     err = ota_init();
     if ( err != ESP_OK ) {
+        req_auth_abort(&ra);
+        pool_put(buf);
         flush_post_data(req);
         return err;
     }
 
     // Read any posted data
     while (remaining > 0) {
-        /* Read the data for the request */
-        if ((ret = httpd_req_recv(req, bigbuf,
-                        MIN(remaining, sizeof(bigbuf)))) <= 0) {
+        /* Read the data for the request, timing it apart from the flash write */
+        start = esp_timer_get_time();
+        ret = httpd_req_recv(req, buf, MIN(remaining, pool_block_size()));
+        ota_recv_time(esp_timer_get_time() - start, ret);
+        if (ret <= 0) {
             if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
                 /* Retry receiving if timeout occurred */
                 continue;
             }
+            req_auth_abort(&ra);
+            pool_put(buf);
             return ota_finish( ESP_FAIL );
         }
         remaining -= ret;
+        req_auth_update(&ra, buf, ret);
 
-        err = ota_write( bigbuf, ret );
+        err = ota_write( buf, ret );
         if ( err != ESP_OK ) {
+            req_auth_abort(&ra);
+            pool_put(buf);
             flush_post_data(req);
-            return err;
+            return ota_finish( err );
         }
     }
 
-    return ota_finish( ESP_OK );
+    /* An unsigned image is written but never made bootable */
+    if (req_auth_finish(req, &ra, TRACE_URI_UPDATE) != ESP_OK) {
+        pool_put(buf);
+        return ota_finish( ESP_FAIL );
+    }
+    err = ota_finish( ESP_OK );
+
+    /* Report how the time was spent, receive versus flash write */
+    buf[0] = '{';
+    n = 1 + ota_status_json(buf + 1, pool_block_size() - 3);
+    n = MIN(n, pool_block_size() - 3);
+    buf[n++] = '}';
+    buf[n++] = '\n';
+    if (err != ESP_OK)
+        httpd_resp_set_status(req, HTTPD_500);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, buf, n);
+    pool_put(buf);
+    return err;
 }
 
 /* Handler to respond to wildcard URI and direct the reponse */
 static esp_err_t post_handler(httpd_req_t *req)
 {
+    http_served(req);
+
     /* Return one of a limited number of supported paths */
-    ESP_LOGI(TAG, "POST: %s", req->uri);
     if (strncmp(req->uri, "/ctrl?", 6) == 0) {
+        trace(TRACE_HTTP_POST, TRACE_URI_CTRL, req->content_len, 0);
         return ctrl_post_handler(req);
     }
+    else if (strncmp(req->uri, "/arm?", 5) == 0) {
+        trace(TRACE_HTTP_POST, TRACE_URI_ARM, req->content_len, 0);
+        return arm_post_handler(req);
+    }
+    else if ((strcmp(req->uri, "/type") == 0) || (strncmp(req->uri, "/type?", 6) == 0)) {
+        trace(TRACE_HTTP_POST, TRACE_URI_TYPE, req->content_len, 0);
+        return type_post_handler(req);
+    }
+#if CONFIG_WEBKEY_USB_CONTROL
+    else if (strncmp(req->uri, "/power?", 7) == 0) {
+        trace(TRACE_HTTP_POST, TRACE_URI_POWER, req->content_len, 0);
+        return control_post_handler(req, true);
+    }
+    else if (strncmp(req->uri, "/consumer?", 10) == 0) {
+        trace(TRACE_HTTP_POST, TRACE_URI_CONSUMER, req->content_len, 0);
+        return control_post_handler(req, false);
+    }
+#endif
     else if (strcmp(req->uri, "/config") == 0) {
+        trace(TRACE_HTTP_POST, TRACE_URI_CONFIG, req->content_len, 0);
+#if CONFIG_WEBKEY_HTTPS
+        if (https_required(req)) {
+            httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Use https");
+            return ESP_FAIL;
+        }
+#endif
         return config_post_handler(req);
     }
     else if (strcmp(req->uri, "/update") == 0) {
+        trace(TRACE_HTTP_POST, TRACE_URI_UPDATE, req->content_len, 0);
+#if CONFIG_WEBKEY_HTTPS
+        if (https_required(req)) {
+            httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Use https");
+            return ESP_FAIL;
+        }
+#endif
         return update_post_handler(req);
     }
+    trace(TRACE_HTTP_POST, TRACE_URI_OTHER, req->content_len, 0);
 
     // Clean up any garbage
     if (flush_post_data(req) != ESP_OK)
@@ -306,14 +1235,59 @@ static const httpd_uri_t uri_post = {
     .user_ctx  = NULL
 };
 
+#if CONFIG_WEBKEY_HTTPS
+/* Start the HTTPS server beside the plain one. Connections are kept alive
+ * and, with session tickets, a returning client resumes its TLS session
+ * without repeating the ECDHE/ECDSA handshake. */
+static void start_secure_webserver(void)
+{
+    extern const unsigned char servercert_start[] asm("_binary_servercert_pem_start");
+    extern const unsigned char servercert_end[]   asm("_binary_servercert_pem_end");
+    extern const unsigned char prvtkey_start[]    asm("_binary_prvtkey_pem_start");
+    extern const unsigned char prvtkey_end[]      asm("_binary_prvtkey_pem_end");
+    httpd_ssl_config_t conf = HTTPD_SSL_CONFIG_DEFAULT();
+
+    if (secure_server)
+        return;
+    conf.cacert_pem = servercert_start;
+    conf.cacert_len = servercert_end - servercert_start;
+    conf.prvtkey_pem = prvtkey_start;
+    conf.prvtkey_len = prvtkey_end - prvtkey_start;
+    conf.httpd.uri_match_fn = httpd_uri_match_wildcard;
+    conf.httpd.ctrl_port = ESP_HTTPD_DEF_CTRL_PORT + 1;
+    conf.httpd.max_open_sockets = HTTPS_MAX_SOCKETS;
+    conf.httpd.lru_purge_enable = true;
+#if CONFIG_ESP_TLS_SERVER_SESSION_TICKETS
+    conf.session_tickets = true;
+#endif
+
+    ESP_LOGI(TAG, "Starting server on port: '%d'", conf.port_secure);
+    if (httpd_ssl_start(&secure_server, &conf) == ESP_OK) {
+        httpd_register_uri_handler(secure_server, &uri_get);
+        httpd_register_uri_handler(secure_server, &uri_post);
+        return;
+    }
+    ESP_LOGI(TAG, "Error starting secure server!");
+    secure_server = NULL;
+}
+#endif
+
 /* Start up the webserver */
 static httpd_handle_t start_webserver(void)
 {
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
+#if CONFIG_WEBKEY_HTTPS
+    start_secure_webserver();
+#endif
+
     // Start the httpd server
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_open_sockets = HTTP_MAX_SOCKETS;
+    config.lru_purge_enable = true;     // A connection lost with the link must not lock out new ones
+    config.open_fn = http_open_fn;
+    config.close_fn = http_close_fn;
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
     if (httpd_start(&server, &config) == ESP_OK) {
         // Set URI handlers
@@ -327,31 +1301,44 @@ static httpd_handle_t start_webserver(void)
     return NULL;
 }
 
-static void stop_webserver(httpd_handle_t server)
-{
-    // Stop the httpd server
-    httpd_stop(server);
-}
-
+/* The server stays up, only remember when the link went */
 static void disconnect_handler(void* arg, esp_event_base_t event_base,
                                int32_t event_id, void* event_data)
 {
-    httpd_handle_t* server = (httpd_handle_t*) arg;
-    if (*server) {
-        ESP_LOGI(TAG, "Stopping webserver");
-        stop_webserver(*server);
-        *server = NULL;
+    if (sta_ip != 0) {
+        link_lost_time = esp_timer_get_time();
+        link_back_time = 0;
+        sta_ip = 0;
     }
-    web_server_down = 1;
 }
 
 static void connect_handler(void* arg, esp_event_base_t event_base,
                             int32_t event_id, void* event_data)
 {
     httpd_handle_t* server = (httpd_handle_t*) arg;
+    ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+
+    if (link_lost_time)
+        link_back_time = esp_timer_get_time();
+    sta_ip = event->ip_info.ip.addr;
+
+    /* Connections to the old address can never complete, free their slots */
+    if (*server && event->ip_changed) {
+        for (int i = 0; i < HTTP_MAX_SOCKETS; i++) {
+            if ((http_conns[i].fd >= 0) && (http_conns[i].local_ip != sta_ip) &&
+                (http_conns[i].local_ip != 0)) {
+                sta_dead_ip = http_conns[i].local_ip;
+                httpd_queue_work(*server, http_close_dead, NULL);
+                break;
+            }
+        }
+    }
+
+    /* Only if it failed to start before */
     if (*server == NULL) {
         ESP_LOGI(TAG, "Starting webserver");
         *server = start_webserver();
+        http_server = *server;
     }
 }
 
@@ -360,12 +1347,11 @@ void server_init(void)
 {
     static httpd_handle_t server = NULL;
 
-    /* Register event handlers to stop the server when Wi-Fi
-     * and re-start it upon connection.
-     */
+    /* Track the link for recovery timing, the server itself keeps running */
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_handler, &server));
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnect_handler, &server));
 
     /* Start the server for the first time */
     server = start_webserver();
+    http_server = server;
 }
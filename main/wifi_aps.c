@@ -0,0 +1,178 @@
+/* Known access points
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+
+#include "wifi_aps.h"
+
+/* Should put these in .h file(s) */
+extern const char *TAG;
+
+#define WIFI_APS_VERSION    1
+
+/* Stored form, saved up to the last used entry */
+typedef struct
+{
+    uint8_t version;
+    uint8_t count;
+    wifi_ap_t aps[WIFI_APS_MAX];
+} wifi_aps_store_t;
+
+/* Local storage, read from the WiFi event task and written by the config page */
+static wifi_aps_store_t aps_store;
+static portMUX_TYPE aps_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void wifi_aps_init(void)
+{
+    wifi_aps_store_t *store = &aps_store;
+    nvs_handle_t nvsHandle;
+    size_t len = sizeof(*store);
+
+    if (nvs_open("storage", NVS_READONLY, &nvsHandle) == ESP_OK) {
+        esp_err_t err = nvs_get_blob(nvsHandle, "WIFI_APS", store, &len);
+        if ((err == ESP_OK) && (store->version == WIFI_APS_VERSION) && (store->count >= 1) &&
+            (store->count <= WIFI_APS_MAX) && (len == offsetof(wifi_aps_store_t, aps[store->count]))) {
+            nvs_close(nvsHandle);
+            for (int i = 0; i < store->count; i++) {
+                store->aps[i].ssid[sizeof(store->aps[i].ssid) - 1] = '\0';
+                store->aps[i].pass[sizeof(store->aps[i].pass) - 1] = '\0';
+            }
+            ESP_LOGI(TAG, "%u known access points", store->count);
+            return;
+        }
+
+        /* Single network from before the list */
+        memset(store, 0, sizeof(*store));
+        len = sizeof(store->aps[0].ssid);
+        if (nvs_get_str(nvsHandle, "WIFI_SSID", store->aps[0].ssid, &len) == ESP_OK) {
+            len = sizeof(store->aps[0].pass);
+            if (nvs_get_str(nvsHandle, "WIFI_PASS", store->aps[0].pass, &len) != ESP_OK)
+                store->aps[0].pass[0] = '\0';
+        }
+        nvs_close(nvsHandle);
+    } else {
+        memset(store, 0, sizeof(*store));
+    }
+
+    if (store->aps[0].ssid[0] == '\0') {
+        ESP_LOGI(TAG, "WiFi SSID not set, using default");
+        strlcpy(store->aps[0].ssid, CONFIG_ESP_WIFI_SSID, sizeof(store->aps[0].ssid));
+        strlcpy(store->aps[0].pass, CONFIG_ESP_WIFI_PASSWORD, sizeof(store->aps[0].pass));
+    }
+    store->version = WIFI_APS_VERSION;
+    store->count = 1;
+}
+
+int wifi_aps_count(void)
+{
+    return aps_store.count;
+}
+
+bool wifi_aps_get(int index, wifi_ap_t *ap)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&aps_lock);
+    if ((index >= 0) && (index < aps_store.count)) {
+        *ap = aps_store.aps[index];
+        found = true;
+    }
+    portEXIT_CRITICAL(&aps_lock);
+    return found;
+}
+
+int wifi_aps_find(const char *ssid, size_t len)
+{
+    int index = -1;
+
+    portENTER_CRITICAL(&aps_lock);
+    for (int i = 0; i < aps_store.count; i++) {
+        if ((strnlen(aps_store.aps[i].ssid, sizeof(aps_store.aps[i].ssid)) == len) &&
+            (memcmp(aps_store.aps[i].ssid, ssid, len) == 0)) {
+            index = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&aps_lock);
+    return index;
+}
+
+esp_err_t wifi_aps_save(const char *const ssid[], const char *const pass[], int count)
+{
+    static wifi_aps_store_t next;       // Only the config handler saves
+    nvs_handle_t nvsHandle;
+    esp_err_t err;
+
+    if ((count < 1) || (count > WIFI_APS_MAX))
+        return ESP_ERR_INVALID_ARG;
+
+    memset(&next, 0, sizeof(next));
+    next.version = WIFI_APS_VERSION;
+    next.count = count;
+    for (int i = 0; i < count; i++) {
+        wifi_ap_t old;
+        int const known = wifi_aps_find(ssid[i], strlen(ssid[i]));
+
+        if ((strlen(ssid[i]) < 1) || (strlen(ssid[i]) > 32) || (pass[i] && (strlen(pass[i]) > 63)))
+            return ESP_ERR_INVALID_ARG;
+        strlcpy(next.aps[i].ssid, ssid[i], sizeof(next.aps[i].ssid));
+        if (pass[i] != NULL)
+            strlcpy(next.aps[i].pass, pass[i], sizeof(next.aps[i].pass));
+        else if (wifi_aps_get(known, &old))
+            strlcpy(next.aps[i].pass, old.pass, sizeof(next.aps[i].pass));
+    }
+
+    err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+    if (err != ESP_OK)
+        return err;
+    err = nvs_set_blob(nvsHandle, "WIFI_APS", &next, offsetof(wifi_aps_store_t, aps[count]));
+    if (err == ESP_OK)
+        err = nvs_set_str(nvsHandle, "WIFI_SSID", next.aps[0].ssid);
+    if (err == ESP_OK)
+        err = nvs_set_str(nvsHandle, "WIFI_PASS", next.aps[0].pass);
+    if (err == ESP_OK)
+        err = nvs_commit(nvsHandle);
+    nvs_close(nvsHandle);
+    if (err != ESP_OK)
+        return err;
+
+    portENTER_CRITICAL(&aps_lock);
+    aps_store = next;
+    portEXIT_CRITICAL(&aps_lock);
+    return ESP_OK;
+}
+
+int wifi_aps_json(char *buf, size_t len)
+{
+    wifi_ap_t ap;
+    int n = snprintf(buf, len, "[");
+
+    for (int i = 0; wifi_aps_get(i, &ap) && (n < (int) len); i++) {
+        n += snprintf(buf + n, len - n, "%s\"", i ? "," : "");
+        /* SSIDs are any 32 bytes, escape what JSON needs */
+        for (const char *c = ap.ssid; *c && (n < (int) len); c++) {
+            if ((*c == '"') || (*c == '\\'))
+                n += snprintf(buf + n, len - n, "\\%c", *c);
+            else if ((unsigned char) *c < 0x20)
+                n += snprintf(buf + n, len - n, "\\u%04x", *c);
+            else
+                n += snprintf(buf + n, len - n, "%c", *c);
+        }
+        if (n < (int) len)
+            n += snprintf(buf + n, len - n, "\"");
+    }
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n, "]");
+    return n;
+}
@@ -0,0 +1,49 @@
+/* Known access points
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef WIFI_APS_H_
+#define WIFI_APS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/* Ordered list of station credentials, kept in NVS as the WIFI_APS blob.
+ * A device that only has the older WIFI_SSID/WIFI_PASS pair (or the Kconfig
+ * defaults) starts with that as its one entry. The first entry is also
+ * written back to WIFI_SSID/WIFI_PASS so older firmware still connects. */
+
+#define WIFI_APS_MAX        4
+
+typedef struct
+{
+    char ssid[33];
+    char pass[65];
+} wifi_ap_t;
+
+/* Load the list from NVS */
+void wifi_aps_init(void);
+
+/* Number of entries */
+int wifi_aps_count(void);
+
+/* Copy entry 'index', false past the end */
+bool wifi_aps_get(int index, wifi_ap_t *ap);
+
+/* Position of an SSID in the list, -1 if unknown */
+int wifi_aps_find(const char *ssid, size_t len);
+
+/* Replace the list, saved now and used from the next (re)connect. A NULL
+ * pass keeps the stored one for that SSID. */
+esp_err_t wifi_aps_save(const char *const ssid[], const char *const pass[], int count);
+
+/* Write the SSIDs as a JSON array, passwords are never shown */
+int wifi_aps_json(char *buf, size_t len);
+
+#endif /* WIFI_APS_H_ */
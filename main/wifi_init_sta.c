@@ -16,15 +16,26 @@
 #include "esp_log.h"
 #include "nvs_flash.h"
 
+#include "esp_timer.h"
+#include "esp_netif_net_stack.h"
+#include <time.h>
+#include <sys/param.h>
+
 #include "lwip/err.h"
 #include "lwip/sys.h"
+#include "lwip/dhcp.h"
+#include "lwip/etharp.h"
+#include "lwip/tcpip.h"
+
+#include "wifi_aps.h"
+#include "wifi_ps.h"
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
 
 /* The event group allows multiple bits for each event, but we only care about two events:
  * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
+ * - no known AP could be joined on the first pass, boot carries on and we keep scanning */
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT      BIT1
 
@@ -32,97 +43,584 @@ static const char *TAG = "wifi station";
 
 static int s_retry_num = 0;
 
+/* Known APs seen in the last scan, strongest first. A lost or failed link
+ * moves on to the next one, a new scan is only made once all have failed. */
+#define WIFI_SCAN_MAX       20          // Scan results looked at
+#define WIFI_RESCAN_MIN_MS  1000        // Wait before scanning again when nothing known was found
+#define WIFI_RESCAN_MAX_MS  30000
+
+typedef struct {
+    int8_t index;           // in the known AP list
+    int8_t rssi;
+    uint8_t channel;
+    uint8_t bssid[6];
+} ap_candidate_t;
+
+static wifi_ap_record_t s_scan_records[WIFI_SCAN_MAX];
+static ap_candidate_t s_candidates[WIFI_APS_MAX];
+static int s_num_candidates = 0;
+static int s_candidate = 0;
+static int s_ap_index = -1;                         // Known AP joined, -1 while not connected
+static bool s_link_up = false;
+static uint32_t s_rescan_ms = WIFI_RESCAN_MIN_MS;
+static esp_timer_handle_t s_rescan_timer = NULL;
+
+/* Failover timing, from losing the link to having an address again */
+static int64_t s_failover_start = 0;                // us
+static int64_t s_scan_start = 0;                    // us
+static int32_t s_scan_ms = -1;                      // last scan
+static int32_t s_failover_ms = -1;                  // last failover
+static int32_t s_failover_max_ms = -1;
+static uint32_t s_failovers = 0;
+static uint32_t s_scans = 0;
+
+/* Where the station address comes from. A cached lease is applied before
+ * connecting so the server is reachable as soon as the link is up, and is
+ * confirmed in the background with ARP: the gateway must answer and nobody
+ * else may answer for the address. */
+typedef enum {
+    IP_SRC_DHCP = 0,
+    IP_SRC_CACHED,
+    IP_SRC_STATIC,
+    IP_SRC_COUNT
+} ip_source_t;
+
+static const char * const ip_source_names[IP_SRC_COUNT] = { "dhcp", "cached", "static" };
+
+/* Last DHCP lease, stored in NVS as IP_LEASE */
+typedef struct {
+    uint32_t ip;            // network byte order
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+    uint32_t lease;         // seconds
+    int64_t  obtained;      // time() when the lease was granted
+    char     ssid[33];
+} ip_lease_t;
+
+#define LEASE_DEFAULT_S     3600    // If the server did not tell us
+#define LEASE_UNKNOWN_RENEW 60      // Renew soon if the lease age is unknown
+#define LEASE_PROBES        3       // ARP requests for the address and the gateway
+#define LEASE_PROBE_MS      300     // Between them, and before the last look at the ARP table
+
+static esp_netif_t *s_sta_netif = NULL;
+static ip_source_t s_ip_source = IP_SRC_DHCP;
+static ip_lease_t s_lease;
+static int s_lease_index = -1;                      // Known AP the lease belongs to
+static int64_t s_connect_start = 0;                 // us, esp_wifi_start/connect
+static int32_t s_time_to_ip[IP_SRC_COUNT] = { -1, -1, -1 };   // ms, last for each source
+static bool s_lease_confirmed = false;
+static esp_timer_handle_t s_renew_timer = NULL;
+static esp_timer_handle_t s_probe_timer = NULL;
+static int s_probes = 0;                            // Probe rounds run
+static volatile bool s_probe_conflict = false;      // Someone else answered for our address
+static volatile bool s_probe_gw = false;            // Gateway answered
+
+/* Read a dotted quad from NVS */
+static bool nvs_get_ip4(nvs_handle_t nvsHandle, const char *key, esp_ip4_addr_t *addr)
+{
+    char str[16];
+    size_t len = sizeof(str);
+
+    if (nvs_get_str(nvsHandle, key, str, &len) != ESP_OK)
+        return false;
+    return esp_netif_str_to_ip4(str, addr) == ESP_OK;
+}
+
+/* Static IP profile from config page (IP_MODE 1), returns false to use DHCP */
+static bool load_static_ip(esp_netif_ip_info_t *info, esp_ip4_addr_t *dns)
+{
+    nvs_handle_t nvsHandle;
+    uint8_t mode = 0;
+    bool ok = false;
+
+    if (nvs_open("storage", NVS_READONLY, &nvsHandle) != ESP_OK)
+        return false;
+    if ((nvs_get_u8(nvsHandle, "IP_MODE", &mode) == ESP_OK) && (mode == 1)) {
+        ok = nvs_get_ip4(nvsHandle, "IP_ADDR", &info->ip) &&
+             nvs_get_ip4(nvsHandle, "IP_MASK", &info->netmask) &&
+             nvs_get_ip4(nvsHandle, "IP_GW", &info->gw);
+        if (!nvs_get_ip4(nvsHandle, "IP_DNS", dns))
+            *dns = info->gw;
+        if (!ok)
+            ESP_LOGI(TAG, "Static IP profile incomplete, using DHCP");
+    }
+    nvs_close(nvsHandle);
+    return ok;
+}
+
+/* NVS key of the lease cached for a known AP */
+static void lease_key(int index, char *key, size_t len)
+{
+    snprintf(key, len, "IP_LEASE%d", index);
+}
+
+/* Cached lease for this SSID, returns false if none or known to be expired */
+static bool load_cached_lease(int index, const char *wifi_ssid, ip_lease_t *lease)
+{
+    nvs_handle_t nvsHandle;
+    size_t len = sizeof(*lease);
+    char key[16];
+    esp_err_t err;
+
+    lease_key(index, key, sizeof(key));
+    if (nvs_open("storage", NVS_READONLY, &nvsHandle) != ESP_OK)
+        return false;
+    err = nvs_get_blob(nvsHandle, key, lease, &len);
+    nvs_close(nvsHandle);
+
+    if ((err != ESP_OK) || (len != sizeof(*lease)) || (strcmp(lease->ssid, wifi_ssid) != 0))
+        return false;
+
+    /* The clock survives a soft reset but not a power cycle, only trust it if it moved forward */
+    int64_t now = time(NULL);
+    if ((now >= lease->obtained) && (now - lease->obtained >= lease->lease)) {
+        ESP_LOGI(TAG, "Cached lease expired");
+        return false;
+    }
+    return true;
+}
+
+static void save_lease(const esp_netif_ip_info_t *info)
+{
+    nvs_handle_t nvsHandle;
+    char key[16];
+    esp_netif_dns_info_t dns = { 0 };
+    wifi_config_t wifi_config;
+    struct netif *lwip_netif = esp_netif_get_netif_impl(s_sta_netif);
+    struct dhcp *dhcp = lwip_netif ? netif_dhcp_data(lwip_netif) : NULL;
+
+    memset(&s_lease, 0, sizeof(s_lease));
+    s_lease.ip = info->ip.addr;
+    s_lease.netmask = info->netmask.addr;
+    s_lease.gw = info->gw.addr;
+    esp_netif_get_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+    s_lease.dns = dns.ip.u_addr.ip4.addr;
+    s_lease.lease = (dhcp && dhcp->offered_t0_lease) ? dhcp->offered_t0_lease : LEASE_DEFAULT_S;
+    s_lease.obtained = time(NULL);
+    if (esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config) == ESP_OK)
+        strlcpy(s_lease.ssid, (const char *) wifi_config.sta.ssid, sizeof(s_lease.ssid));
+
+    if (s_lease_index < 0)
+        return;
+    lease_key(s_lease_index, key, sizeof(key));
+    if (nvs_open("storage", NVS_READWRITE, &nvsHandle) != ESP_OK)
+        return;
+    if ((nvs_set_blob(nvsHandle, key, &s_lease, sizeof(s_lease)) != ESP_OK) ||
+        (nvs_commit(nvsHandle) != ESP_OK))
+        ESP_LOGI(TAG, "Error writing lease to NVS");
+    nvs_close(nvsHandle);
+}
+
+static void forget_lease(void)
+{
+    nvs_handle_t nvsHandle;
+    char key[16];
+
+    if (s_lease_index < 0)
+        return;
+    lease_key(s_lease_index, key, sizeof(key));
+    if (nvs_open("storage", NVS_READWRITE, &nvsHandle) != ESP_OK)
+        return;
+    nvs_erase_key(nvsHandle, key);
+    nvs_commit(nvsHandle);
+    nvs_close(nvsHandle);
+}
+
+/* Use a fixed address instead of running the DHCP client */
+static void apply_ip(const esp_netif_ip_info_t *info, esp_ip4_addr_t dns)
+{
+    esp_netif_dns_info_t dns_info = { 0 };
+
+    esp_netif_dhcpc_stop(s_sta_netif);
+    if (esp_netif_set_ip_info(s_sta_netif, info) != ESP_OK)
+        ESP_LOGE(TAG, "Failed to set ip info");
+    dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+    dns_info.ip.u_addr.ip4 = dns;
+    esp_netif_set_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns_info);
+}
+
+/* Give up on the cached lease and ask the server */
+static void start_dhcp(void)
+{
+    esp_netif_dhcp_status_t status = ESP_NETIF_DHCP_INIT;
+
+    s_ip_source = IP_SRC_DHCP;
+    esp_netif_dhcpc_get_status(s_sta_netif, &status);
+    if (status == ESP_NETIF_DHCP_STOPPED)
+        esp_netif_dhcpc_start(s_sta_netif);
+}
+
+static void renew_timer_cb(void *arg)
+{
+    if (s_ip_source == IP_SRC_CACHED) {
+        ESP_LOGI(TAG, "Renewing cached lease via DHCP");
+        start_dhcp();
+    }
+}
+
+/* Probe result is in, keep the lease or fall back to DHCP */
+static void lease_probe_end(bool conflict, bool gw)
+{
+    int64_t remaining = LEASE_UNKNOWN_RENEW;
+    int64_t now = time(NULL);
+
+    if (conflict || !gw) {
+        ESP_LOGI(TAG, "%s, dropping cached lease", conflict ? "Address is in use" : "Gateway did not answer");
+        forget_lease();
+        start_dhcp();
+        return;
+    }
+    s_lease_confirmed = true;
+
+    /* Hand over to DHCP at half the remaining lease, like a normal renewal */
+    if ((now >= s_lease.obtained) && (now - s_lease.obtained < s_lease.lease))
+        remaining = (s_lease.lease - (now - s_lease.obtained)) / 2;
+    if (s_renew_timer == NULL) {
+        const esp_timer_create_args_t args = { .callback = renew_timer_cb, .name = "lease" };
+        esp_timer_create(&args, &s_renew_timer);
+    }
+    esp_timer_stop(s_renew_timer);
+    esp_timer_start_once(s_renew_timer, remaining * 1000000LL);
+    ESP_LOGI(TAG, "Cached lease confirmed, renewing in %lld s", remaining);
+}
+
+/* Runs in the lwIP thread. An answer to a request for our own address
+ * leaves an ARP entry for it, which only another host can have caused.
+ * arg says whether to send another round of requests after looking. */
+static void lease_probe_step(void *arg)
+{
+    struct netif *netif = esp_netif_get_netif_impl(s_sta_netif);
+    ip4_addr_t const ip = { .addr = s_lease.ip };
+    ip4_addr_t const gw = { .addr = s_lease.gw };
+    struct eth_addr *eth;
+    const ip4_addr_t *entry;
+
+    if (netif == NULL)
+        return;
+    if (etharp_find_addr(netif, &ip, &eth, &entry) >= 0)
+        s_probe_conflict = true;
+    if (etharp_find_addr(netif, &gw, &eth, &entry) >= 0)
+        s_probe_gw = true;
+    if (arg) {
+        etharp_request(netif, &ip);
+        if (!s_probe_gw)
+            etharp_request(netif, &gw);
+    }
+}
+
+static void lease_probe_cb(void *arg)
+{
+    /* DHCP took over meanwhile */
+    if (s_ip_source != IP_SRC_CACHED)
+        return;
+    if (s_probe_conflict || (s_probes > LEASE_PROBES)) {
+        lease_probe_end(s_probe_conflict, s_probe_gw);
+        return;
+    }
+    /* The last round only looks at the table */
+    tcpip_callback(lease_probe_step, (void *) (uintptr_t) (s_probes < LEASE_PROBES));
+    s_probes++;
+    esp_timer_start_once(s_probe_timer, LEASE_PROBE_MS * 1000LL);
+}
+
+/* Check the cached lease still fits this network without holding up the server.
+ * Pinging the gateway cannot tell whether another host was given the address
+ * meanwhile, so ask for the address itself as DHCP's own ARP check would. */
+static void confirm_lease(void)
+{
+    if (s_probe_timer == NULL) {
+        const esp_timer_create_args_t args = { .callback = lease_probe_cb, .name = "probe" };
+        esp_timer_create(&args, &s_probe_timer);
+    }
+    esp_timer_stop(s_probe_timer);
+    s_probes = 0;
+    s_probe_conflict = false;
+    s_probe_gw = false;
+    lease_probe_cb(NULL);
+}
+
+/* Pick the address source for the AP about to be joined */
+static void select_ip_source(int index, const char *wifi_ssid)
+{
+    esp_netif_ip_info_t ip_info = { 0 };
+    esp_ip4_addr_t dns = { 0 };
+
+    if (s_renew_timer)
+        esp_timer_stop(s_renew_timer);
+    s_lease_confirmed = false;
+    s_lease_index = index;
+    if (load_static_ip(&ip_info, &dns)) {
+        s_ip_source = IP_SRC_STATIC;
+        apply_ip(&ip_info, dns);
+    } else if (load_cached_lease(index, wifi_ssid, &s_lease)) {
+        s_ip_source = IP_SRC_CACHED;
+        ip_info.ip.addr = s_lease.ip;
+        ip_info.netmask.addr = s_lease.netmask;
+        ip_info.gw.addr = s_lease.gw;
+        dns.addr = s_lease.dns;
+        apply_ip(&ip_info, dns);
+    } else {
+        start_dhcp();
+    }
+    ESP_LOGI(TAG, "ip source: %s", ip_source_names[s_ip_source]);
+}
+
+/* Join a known AP, on a specific BSSID and channel when a scan found it */
+static void connect_ap(int index, const ap_candidate_t *found)
+{
+    wifi_ap_t ap;
+    wifi_config_t wifi_config = {
+        .sta = {
+            /* Setting a password implies station will connect to all security modes including WEP/WPA.
+             * However these modes are deprecated and not advisable to be used. Incase your Access point
+             * doesn't support WPA2, these mode can be enabled by commenting below line */
+	     .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+
+            .pmf_cfg = {
+                .capable = true,
+                .required = false
+            },
+        },
+    };
+
+    if (!wifi_aps_get(index, &ap))
+        return;
+
+    /* Using memcpy allows the max SSID length to be 32 bytes (as per 802.11 standard).
+     * But this doesn't guarantee that the saved SSID will be null terminated, because
+     * wifi_cfg->sta.ssid is also 32 bytes long (without extra 1 byte for null character).
+     * Although, this is not a matter for concern because esp_wifi library reads the SSID
+     * upto 32 bytes in absence of null termination */
+    memcpy(wifi_config.sta.ssid, ap.ssid, strnlen(ap.ssid, sizeof(wifi_config.sta.ssid)));
+
+    /* Using strlcpy allows both max passphrase length (63 bytes) and ensures null termination
+     * because size of wifi_config.sta.password is 64 bytes (1 extra byte for null character) */
+    strlcpy((char *) wifi_config.sta.password, ap.pass, sizeof(wifi_config.sta.password));
+    if (ap.pass[0] == '\0')
+        wifi_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
+
+    /* Skip the driver's own scan when we already know where the AP is */
+    if (found) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, found->bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = found->channel;
+        ESP_LOGI(TAG, "joining %s (rssi %d, channel %u)", ap.ssid, found->rssi, found->channel);
+    } else {
+        ESP_LOGI(TAG, "joining %s", ap.ssid);
+    }
+
+    select_ip_source(index, ap.ssid);
+    s_retry_num = 0;
+    s_connect_start = esp_timer_get_time();
+    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
+    esp_wifi_connect();
+}
+
+static void start_scan(void)
+{
+    wifi_scan_config_t config = { .show_hidden = true };
+    esp_err_t err;
+
+    s_scan_start = esp_timer_get_time();
+    err = esp_wifi_scan_start(&config, false);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) starting scan", esp_err_to_name(err));
+        esp_timer_start_once(s_rescan_timer, (int64_t) s_rescan_ms * 1000);
+    }
+}
+
+static void rescan_timer_cb(void *arg)
+{
+    start_scan();
+}
+
+/* Nothing (more) to try, look again later and let boot continue */
+static void schedule_rescan(void)
+{
+    ESP_LOGI(TAG, "no known AP to join, scanning again in %u ms", s_rescan_ms);
+    xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+    esp_timer_start_once(s_rescan_timer, (int64_t) s_rescan_ms * 1000);
+    s_rescan_ms = MIN(s_rescan_ms * 2, WIFI_RESCAN_MAX_MS);
+}
+
+/* Rank the known APs in the scan by signal, then join the strongest */
+static void scan_done(void)
+{
+    uint16_t count = WIFI_SCAN_MAX;
+
+    s_scan_ms = (esp_timer_get_time() - s_scan_start) / 1000;
+    s_scans++;
+    if (esp_wifi_scan_get_ap_records(&count, s_scan_records) != ESP_OK)
+        count = 0;
+
+    s_num_candidates = 0;
+    for (int i = 0; i < count; i++) {
+        const wifi_ap_record_t *rec = &s_scan_records[i];
+        int const index = wifi_aps_find((const char *) rec->ssid, strnlen((const char *) rec->ssid, sizeof(rec->ssid)));
+        int pos;
+
+        if (index < 0)
+            continue;
+        /* One entry per known AP, its strongest BSSID */
+        for (pos = 0; (pos < s_num_candidates) && (s_candidates[pos].index != index); pos++)
+            ;
+        if (pos < s_num_candidates) {
+            if (rec->rssi <= s_candidates[pos].rssi)
+                continue;
+        } else {
+            s_num_candidates++;
+        }
+        /* Slide weaker entries down, insertion sort on RSSI */
+        while ((pos > 0) && (s_candidates[pos - 1].rssi < rec->rssi)) {
+            s_candidates[pos] = s_candidates[pos - 1];
+            pos--;
+        }
+        s_candidates[pos].index = index;
+        s_candidates[pos].rssi = rec->rssi;
+        s_candidates[pos].channel = rec->primary;
+        memcpy(s_candidates[pos].bssid, rec->bssid, sizeof(rec->bssid));
+    }
+    ESP_LOGI(TAG, "scan took %d ms, %u APs, %d known", s_scan_ms, count, s_num_candidates);
+
+    s_candidate = 0;
+    if (s_num_candidates == 0) {
+        schedule_rescan();
+        return;
+    }
+    connect_ap(s_candidates[0].index, &s_candidates[0]);
+}
+
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
+        /* With a single network there is nothing to choose between */
+        if (wifi_aps_count() == 1) {
+            connect_ap(0, NULL);
+        } else {
+            start_scan();
+        }
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+        scan_done();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        s_link_up = true;
+        s_ap_index = s_lease_index;
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < CONFIG_ESP_MAXIMUM_RETRY) {
-            esp_wifi_connect();
-            s_retry_num++;
+        if (s_link_up) {
+            /* Lost a working link, find the best AP now rather than retrying this one */
+            ESP_LOGI(TAG, "lost the AP, scanning");
+            s_link_up = false;
+            s_ap_index = -1;
+            s_failover_start = esp_timer_get_time();
+            start_scan();
+        } else if (++s_retry_num < CONFIG_WEBKEY_AP_RETRY) {
             ESP_LOGI(TAG, "retry to connect to the AP");
+            esp_wifi_connect();
+        } else if (++s_candidate < s_num_candidates) {
+            ESP_LOGI(TAG, "connect to the AP fail, trying the next strongest");
+            connect_ap(s_candidates[s_candidate].index, &s_candidates[s_candidate]);
         } else {
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            ESP_LOGI(TAG,"connect to the AP fail");
+            s_num_candidates = 0;
+            schedule_rescan();
         }
-        ESP_LOGI(TAG,"connect to the AP fail");
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
         s_retry_num = 0;
+        s_rescan_ms = WIFI_RESCAN_MIN_MS;
+        if (s_failover_start) {
+            s_failover_ms = (esp_timer_get_time() - s_failover_start) / 1000;
+            s_failover_max_ms = MAX(s_failover_max_ms, s_failover_ms);
+            s_failovers++;
+            s_failover_start = 0;
+            ESP_LOGI(TAG, "failover took %d ms", s_failover_ms);
+        }
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
     }
 }
 
-void wifi_init_sta( int32_t reinit, const char *wifi_ssid, const char *wifi_pass )
+/* Tracks every address change, also after wifi_init_sta has returned */
+static void ip_event_handler(void* arg, esp_event_base_t event_base,
+                             int32_t event_id, void* event_data)
 {
-    if ( reinit ) {
-	ESP_LOGI(TAG, "Disconnect WiFi");
-	ESP_ERROR_CHECK(esp_wifi_stop());
-	ESP_ERROR_CHECK(esp_wifi_deinit());
-        vTaskDelay(pdMS_TO_TICKS(10000));	// allow AP time to recognize disconnect
-	ESP_LOGI(TAG, "Re-initialize WiFi");
+    ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+
+    if (s_connect_start) {
+        s_time_to_ip[s_ip_source] = (esp_timer_get_time() - s_connect_start) / 1000;
+        ESP_LOGI(TAG, "time to ip (%s): %d ms", ip_source_names[s_ip_source], s_time_to_ip[s_ip_source]);
+        s_connect_start = 0;
     }
 
+    if (s_ip_source == IP_SRC_DHCP) {
+        save_lease(&event->ip_info);
+    } else if ((s_ip_source == IP_SRC_CACHED) && !s_lease_confirmed) {
+        confirm_lease();
+    }
+}
+
+int wifi_status_json(char *buf, size_t len)
+{
+    wifi_ap_record_t info;
+    int const rssi = ((s_ap_index >= 0) && (esp_wifi_sta_get_ap_info(&info) == ESP_OK)) ? info.rssi : 0;
+    int n = snprintf(buf, len,
+                     "\"wifi\":{\"ap\":%d,\"rssi\":%d,\"known\":",
+                     s_ap_index, rssi);
+    if (n < (int) len)
+        n += wifi_aps_json(buf + n, len - n);
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n,
+                      ",\"failover\":{\"count\":%u,\"last_ms\":%d,\"max_ms\":%d,\"scans\":%u,\"scan_ms\":%d},"
+                      "\"ip_source\":\"%s\",\"lease_confirmed\":%s,"
+                      "\"time_to_ip_ms\":{\"dhcp\":%d,\"cached\":%d,\"static\":%d},",
+                      s_failovers, s_failover_ms, s_failover_max_ms, s_scans, s_scan_ms,
+                      ip_source_names[s_ip_source], s_lease_confirmed ? "true" : "false",
+                      s_time_to_ip[IP_SRC_DHCP], s_time_to_ip[IP_SRC_CACHED], s_time_to_ip[IP_SRC_STATIC]);
+    if (n < (int) len)
+        n += wifi_ps_status_json(buf + n, len - n);
+    if (n < (int) len)
+        n += snprintf(buf + n, len - n, "}");
+    return n;
+}
+
+void wifi_init_sta(void)
+{
     s_wifi_event_group = xEventGroupCreate();
 
     ESP_ERROR_CHECK(esp_netif_init());
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    s_sta_netif = esp_netif_create_default_wifi_sta();
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &ip_event_handler, NULL));
+
+    const esp_timer_create_args_t rescan_args = { .callback = rescan_timer_cb, .name = "rescan" };
+    ESP_ERROR_CHECK(esp_timer_create(&rescan_args, &s_rescan_timer));
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_t instance_got_ip;
+    /* Kept registered, they handle every later disconnect as well */
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                                                         ESP_EVENT_ANY_ID,
                                                         &event_handler,
                                                         NULL,
-                                                        &instance_any_id));
+                                                        NULL));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
                                                         IP_EVENT_STA_GOT_IP,
                                                         &event_handler,
                                                         NULL,
-                                                        &instance_got_ip));
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            /* Setting a password implies station will connect to all security modes including WEP/WPA.
-             * However these modes are deprecated and not advisable to be used. Incase your Access point
-             * doesn't support WPA2, these mode can be enabled by commenting below line */
-	     .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-
-            .pmf_cfg = {
-                .capable = true,
-                .required = false
-            },
-        },
-    };
-
-    /* Using memcpy allows the max SSID length to be 32 bytes (as per 802.11 standard).
-     * But this doesn't guarantee that the saved SSID will be null terminated, because
-     * wifi_cfg->sta.ssid is also 32 bytes long (without extra 1 byte for null character).
-     * Although, this is not a matter for concern because esp_wifi library reads the SSID
-     * upto 32 bytes in absence of null termination */
-    const size_t ssid_len = strnlen(wifi_ssid, sizeof(wifi_config.sta.ssid));
-    /* Ensure SSID less than 32 bytes is null terminated */
-    memset(wifi_config.sta.ssid, 0, sizeof(wifi_config.sta.ssid));
-    memcpy(wifi_config.sta.ssid, wifi_ssid, ssid_len);
-
-    /* Using strlcpy allows both max passphrase length (63 bytes) and ensures null termination
-     * because size of wifi_config.sta.password is 64 bytes (1 extra byte for null character) */
-    strlcpy((char *) wifi_config.sta.password, wifi_pass, sizeof(wifi_config.sta.password));
+                                                        NULL));
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
+    s_connect_start = esp_timer_get_time();
     ESP_ERROR_CHECK(esp_wifi_start() );
+    wifi_ps_init();
 
     ESP_LOGI(TAG, "wifi_init_sta finished.");
 
-    /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
+    /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or no known AP could be joined
+     * (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
     EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
             WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
             pdFALSE,
@@ -132,16 +630,10 @@ void wifi_init_sta( int32_t reinit, const char *wifi_ssid, const char *wifi_pass
     /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
      * happened. */
     if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG, "connected to ap SSID:%s", wifi_ssid );
+        ESP_LOGI(TAG, "connected to known AP %d", s_ap_index);
     } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGI(TAG, "Failed to connect to SSID:%s", wifi_ssid );
+        ESP_LOGI(TAG, "No known AP joined yet, still trying");
     } else {
         ESP_LOGE(TAG, "UNEXPECTED EVENT");
     }
-
-    /* The event will not be processed after unregister */
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, instance_got_ip));
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, instance_any_id));
-    vEventGroupDelete(s_wifi_event_group);
 }
-
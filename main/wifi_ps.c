@@ -0,0 +1,131 @@
+/* WiFi power-save profiles
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+
+#include "wifi_ps.h"
+
+/* Should put these in .h file(s) */
+extern const char *TAG;
+
+static const char *const ps_profile_names[WIFI_PS_PROFILE_COUNT] = { "none", "min", "max", "auto" };
+static const char *const ps_mode_names[] = { "none", "min", "max" };
+
+/* Local storage */
+static wifi_ps_profile_t ps_profile = WIFI_PS_PROFILE_AUTO;
+static wifi_ps_type_t ps_active = WIFI_PS_MIN_MODEM;    // Station default
+static uint32_t ps_holds = 0;
+static uint32_t ps_switches = 0;
+static SemaphoreHandle_t ps_mutex = NULL;
+static StaticSemaphore_t ps_mutex_buf;
+
+/* Set the radio to what the profile and holds ask for, called with ps_mutex */
+static void ps_apply(void)
+{
+    static const wifi_ps_type_t fixed[] = { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM };
+    wifi_ps_type_t want;
+    esp_err_t err;
+
+    if (ps_profile == WIFI_PS_PROFILE_AUTO) {
+        want = ps_holds ? WIFI_PS_NONE : WIFI_PS_MIN_MODEM;
+    } else {
+        want = fixed[ps_profile];
+    }
+    if (want == ps_active)
+        return;
+
+    err = esp_wifi_set_ps(want);
+    if (err == ESP_OK) {
+        ps_active = want;
+        ps_switches++;
+    } else if (err != ESP_ERR_WIFI_NOT_INIT) {
+        ESP_LOGE(TAG, "Error (%s) setting power save", esp_err_to_name(err));
+    }
+}
+
+void wifi_ps_init(void)
+{
+    nvs_handle_t nvsHandle;
+    uint8_t value;
+
+    if (ps_mutex == NULL)
+        ps_mutex = xSemaphoreCreateMutexStatic(&ps_mutex_buf);
+
+    if (nvs_open("storage", NVS_READONLY, &nvsHandle) == ESP_OK) {
+        if ((nvs_get_u8(nvsHandle, "WIFI_PS", &value) == ESP_OK) && (value < WIFI_PS_PROFILE_COUNT))
+            ps_profile = value;
+        nvs_close(nvsHandle);
+    }
+
+    /* The driver starts in modem sleep whatever we last set */
+    xSemaphoreTake(ps_mutex, portMAX_DELAY);
+    ps_active = WIFI_PS_MIN_MODEM;
+    esp_wifi_get_ps(&ps_active);
+    ps_apply();
+    xSemaphoreGive(ps_mutex);
+    ESP_LOGI(TAG, "power save: %s (%s)", ps_profile_names[ps_profile], ps_mode_names[ps_active]);
+}
+
+esp_err_t wifi_ps_set_profile(const char *name)
+{
+    nvs_handle_t nvsHandle;
+    esp_err_t err;
+    int i;
+
+    for (i = 0; i < WIFI_PS_PROFILE_COUNT; i++) {
+        if (strcmp(name, ps_profile_names[i]) == 0)
+            break;
+    }
+    if (i == WIFI_PS_PROFILE_COUNT)
+        return ESP_ERR_INVALID_ARG;
+
+    err = nvs_open("storage", NVS_READWRITE, &nvsHandle);
+    if (err != ESP_OK)
+        return err;
+    err = nvs_set_u8(nvsHandle, "WIFI_PS", i);
+    if (err == ESP_OK)
+        err = nvs_commit(nvsHandle);
+    nvs_close(nvsHandle);
+    if (err != ESP_OK)
+        return err;
+
+    if (ps_mutex == NULL)
+        return ESP_OK;      // Applied by wifi_ps_init
+    xSemaphoreTake(ps_mutex, portMAX_DELAY);
+    ps_profile = i;
+    ps_apply();
+    xSemaphoreGive(ps_mutex);
+    return ESP_OK;
+}
+
+void wifi_ps_hold(bool hold)
+{
+    if (ps_mutex == NULL)
+        return;
+    xSemaphoreTake(ps_mutex, portMAX_DELAY);
+    if (hold) {
+        ps_holds++;
+    } else if (ps_holds > 0) {
+        ps_holds--;
+    }
+    ps_apply();
+    xSemaphoreGive(ps_mutex);
+}
+
+int wifi_ps_status_json(char *buf, size_t len)
+{
+    return snprintf(buf, len, "\"ps\":{\"profile\":\"%s\",\"active\":\"%s\",\"holds\":%u,\"switches\":%u}",
+                    ps_profile_names[ps_profile], ps_mode_names[ps_active], ps_holds, ps_switches);
+}
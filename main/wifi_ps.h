@@ -0,0 +1,41 @@
+/* WiFi power-save profiles
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#ifndef WIFI_PS_H_
+#define WIFI_PS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/* Modem sleep makes the station wake only for beacons, so a request can wait
+ * up to a DTIM interval before the radio hears it. 'auto' runs min-modem
+ * sleep while idle and no power save while a hold is taken. */
+typedef enum
+{
+    WIFI_PS_PROFILE_NONE = 0,
+    WIFI_PS_PROFILE_MIN,
+    WIFI_PS_PROFILE_MAX,
+    WIFI_PS_PROFILE_AUTO,
+    WIFI_PS_PROFILE_COUNT
+} wifi_ps_profile_t;
+
+/* Load the profile from NVS (WIFI_PS) and apply it, call after esp_wifi_start */
+void wifi_ps_init(void);
+
+/* Select a profile by name (none, min, max, auto), saved and applied now */
+esp_err_t wifi_ps_set_profile(const char *name);
+
+/* Take or release a low-latency hold, nests */
+void wifi_ps_hold(bool hold);
+
+/* Write the "ps" member, used inside the "wifi" status object */
+int wifi_ps_status_json(char *buf, size_t len);
+
+#endif /* WIFI_PS_H_ */
@@ -0,0 +1,17 @@
+# Lean build profile, layered on sdkconfig.defaults:
+#     idf.py -D SDKCONFIG_DEFAULTS="sdkconfig.defaults;sdkconfig.lean" build size-budget
+# Smaller images are faster to send and write over OTA.
+
+CONFIG_COMPILER_OPTIMIZATION_SIZE=y
+CONFIG_COMPILER_OPTIMIZATION_ASSERTIONS_SILENT=y
+
+# Info logs are compiled out, the trace ring (/trace) covers the hot paths
+CONFIG_LOG_DEFAULT_LEVEL_WARN=y
+
+# Only the HID class driver and only the keyboard interface
+CONFIG_WEBKEY_TUSB_ALL_CLASSES=n
+CONFIG_WEBKEY_USB_MOUSE=n
+CONFIG_WEBKEY_USB_CONTROL=n
+
+CONFIG_ESP_ERR_TO_NAME_LOOKUP=n
+CONFIG_HTTPD_WS_SUPPORT=n
@@ -0,0 +1,154 @@
+/* Host test of the signed request replay check across reboots
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "auth.h"
+#include "nvs_flash.h"
+
+const char *TAG = "test";
+
+/* NVS kept in shared memory, so it outlives each boot's process */
+typedef struct
+{
+    int has_mark;
+    int64_t mark;
+    int mark_writes;
+    int fail_writes;
+} fake_nvs_t;
+
+static fake_nvs_t *nvs;
+static int failures = 0;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    (void) name; (void) mode;
+    *handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void) handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void) handle;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+    (void) handle; (void) key; (void) value; (void) length;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    (void) handle; (void) key; (void) value; (void) length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_i64(nvs_handle_t handle, const char *key, int64_t *value)
+{
+    (void) handle;
+    if ((strcmp(key, "AUTH_MARK") != 0) || !nvs->has_mark)
+        return ESP_ERR_NVS_NOT_FOUND;
+    *value = nvs->mark;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_i64(nvs_handle_t handle, const char *key, int64_t value)
+{
+    (void) handle;
+    if ((strcmp(key, "AUTH_MARK") != 0) || nvs->fail_writes)
+        return ESP_FAIL;
+    nvs->has_mark = 1;
+    nvs->mark = value;
+    nvs->mark_writes++;
+    return ESP_OK;
+}
+
+static void expect(const char *name, auth_fresh_t got, auth_fresh_t want)
+{
+    if (got == want)
+        return;
+    failures++;
+    printf("FAIL %s: got %d, expected %d\n", name, got, want);
+}
+
+/* Run one boot in a child, so it starts with the firmware's statics as at power up */
+static int boot(void (*run)(int64_t), int64_t now)
+{
+    int status;
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        auth_init();
+        run(now);
+        fflush(stdout);
+        _exit(failures ? 1 : 0);
+    }
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static void boot_before(int64_t now)
+{
+    expect("first request", auth_check_fresh(now, 1), AUTH_FRESH);
+    expect("same second", auth_check_fresh(now, 2), AUTH_FRESH);
+    expect("replay", auth_check_fresh(now, 1), AUTH_REPLAY);
+    if (nvs->mark_writes != 1) {
+        failures++;
+        printf("FAIL mark written %d times in one second\n", nvs->mark_writes);
+    }
+}
+
+static void boot_after(int64_t now)
+{
+    // A request captured before the reboot, its nonce is forgotten
+    expect("replay after reboot", auth_check_fresh(now, 1), AUTH_STALE);
+    expect("replay after reboot", auth_check_fresh(now, 2), AUTH_STALE);
+
+    // The client's next request, signed right after the reboot
+    expect("request after reboot", auth_check_fresh(now + 1, 3), AUTH_FRESH);
+}
+
+static void boot_failing(int64_t now)
+{
+    nvs->fail_writes = 1;
+    expect("mark not saved", auth_check_fresh(now + 2, 4), AUTH_ERROR);
+    nvs->fail_writes = 0;
+    expect("mark saved", auth_check_fresh(now + 2, 5), AUTH_FRESH);
+}
+
+int main(void)
+{
+    int64_t const now = time(NULL);
+    int res = 0;
+
+    nvs = mmap(NULL, sizeof(*nvs), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (nvs == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(nvs, 0, sizeof(*nvs));
+
+    res |= boot(boot_before, now);
+    res |= boot(boot_after, now);
+    res |= boot(boot_failing, now);
+    printf("%s\n", res ? "auth: failed" : "auth: passed");
+    return res;
+}
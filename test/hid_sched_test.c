@@ -0,0 +1,215 @@
+/* Host test of the keyboard report scheduler
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hid_sched.h"
+
+/* Usage IDs and modifier bits as in TinyUSB's class/hid/hid.h */
+#define HID_KEY_A                   0x04
+#define HID_KEY_B                   0x05
+#define HID_KEY_ENTER               0x28
+#define HID_KEY_SPACE               0x2c
+#define HID_KEY_ARROW_DOWN          0x51
+#define KEYBOARD_MODIFIER_LEFTSHIFT 0x02
+
+/* Timing the HID task drives the scheduler with */
+#define KEY_HOLD_MS         10
+#define LED_KEY_GAP_MS      20
+
+/* Reports and delays as the host would see them */
+typedef struct
+{
+    char log[512];
+    int fail_at;            // Report number to fail, 0 never
+    int sent;
+} recorder_t;
+
+static int tests = 0, failures = 0;
+
+static void log_add(recorder_t *r, const char *item)
+{
+    size_t n = strlen(r->log);
+    snprintf(r->log + n, sizeof(r->log) - n, "%s%s", n ? " " : "", item);
+}
+
+/* "mm:kk" per report, further keys appended as ":kk" */
+static int record_send(void *ctx, uint8_t modifier, const uint8_t keycode[HID_SCHED_KEYS])
+{
+    recorder_t *r = ctx;
+    char item[8 + 3 * HID_SCHED_KEYS];
+    int n;
+
+    if (++r->sent == r->fail_at)
+        return -1;
+    n = snprintf(item, sizeof(item), "%02x:%02x", modifier, keycode[0]);
+    for (int i = 1; (i < HID_SCHED_KEYS) && keycode[i]; i++)
+        n += snprintf(item + n, sizeof(item) - n, ":%02x", keycode[i]);
+    log_add(r, item);
+    return 0;
+}
+
+/* "+ms" per delay */
+static int record_delay(void *ctx, uint32_t ms)
+{
+    char item[16];
+
+    snprintf(item, sizeof(item), "+%u", ms);
+    log_add(ctx, item);
+    return 0;
+}
+
+static void expect(const char *name, const recorder_t *r, const hid_sched_t *s,
+                   const char *log, uint32_t reports)
+{
+    tests++;
+    if ((strcmp(r->log, log) == 0) && (s->reports == reports))
+        return;
+    failures++;
+    printf("FAIL %s\n  expected (%u) %s\n  got      (%u) %s\n", name, reports, log, s->reports, r->log);
+}
+
+/* The LED mode of hid_send_sequence: one space, then "down down enter" as macro.c compiles it */
+static void test_macro(void)
+{
+    static const hid_sched_step_t steps[] = {
+        { 0, HID_KEY_ARROW_DOWN, KEY_HOLD_MS }, { 0, 0, 0 },
+        { 0, HID_KEY_ARROW_DOWN, KEY_HOLD_MS }, { 0, 0, 0 },
+        { 0, HID_KEY_ENTER, KEY_HOLD_MS }, { 0, 0, 0 },
+    };
+    recorder_t r;
+    hid_sched_t s;
+
+    memset(&r, 0, sizeof(r));
+    hid_sched_init(&s, record_send, record_delay, &r);
+    hid_sched_repeat(&s, HID_KEY_SPACE, 1, KEY_HOLD_MS, LED_KEY_GAP_MS);
+    hid_sched_play(&s, steps, sizeof(steps) / sizeof(steps[0]), LED_KEY_GAP_MS);
+
+    // Only the repeated down arrow needs a release of its own
+    expect("down down enter", &r, &s,
+           "00:2c +10 +20 00:51 +10 +20 00:00 00:51 +10 +20 00:28 +10 +20 00:00", 6);
+
+    // Blind lead-in, the 500 ms gaps are long enough to autorepeat so every key is released before them
+    memset(&r, 0, sizeof(r));
+    hid_sched_init(&s, record_send, record_delay, &r);
+    hid_sched_repeat(&s, HID_KEY_SPACE, 3, KEY_HOLD_MS, 500);
+    hid_sched_play(&s, steps + 4, 2, 500);
+    expect("lead-in enter", &r, &s,
+           "00:2c +10 00:00 +500 00:2c +10 00:00 +500 00:2c +10 00:00 +500 00:28 +10 00:00 +500", 8);
+
+    // A macro cut short still ends with everything up
+    memset(&r, 0, sizeof(r));
+    hid_sched_init(&s, record_send, record_delay, &r);
+    hid_sched_play(&s, steps, 1, LED_KEY_GAP_MS);
+    expect("unreleased step", &r, &s, "00:51 +10 00:00", 2);
+}
+
+/* hid_type_text: one key per press, released at the end */
+static void type(recorder_t *r, hid_sched_t *s, const uint8_t (*keys)[2], size_t count)
+{
+    hid_sched_init(s, record_send, record_delay, r);
+    for (size_t i = 0; i < count; i++) {
+        hid_sched_press(s, keys[i][0], &keys[i][1], 1);
+        hid_sched_wait(s, 0);
+    }
+    hid_sched_release(s);
+    hid_sched_flush(s);
+}
+
+static void test_type(void)
+{
+    static const uint8_t aa[][2] = { { 0, HID_KEY_A }, { 0, HID_KEY_A } };
+    static const uint8_t aA[][2] = { { 0, HID_KEY_A }, { KEYBOARD_MODIFIER_LEFTSHIFT, HID_KEY_A } };
+    static const uint8_t Ab[][2] = { { KEYBOARD_MODIFIER_LEFTSHIFT, HID_KEY_A }, { 0, HID_KEY_B } };
+    recorder_t r;
+    hid_sched_t s;
+
+    memset(&r, 0, sizeof(r));
+    type(&r, &s, aa, 2);
+    expect("aa", &r, &s, "00:04 00:00 00:04 00:00", 4);
+
+    // Shift goes down with the release of the first a
+    memset(&r, 0, sizeof(r));
+    type(&r, &s, aA, 2);
+    expect("aA", &r, &s, "00:04 02:00 02:04 00:00", 4);
+
+    // Shift lifts in the same report that presses b
+    memset(&r, 0, sizeof(r));
+    type(&r, &s, Ab, 2);
+    expect("Ab", &r, &s, "02:04 00:05 00:00", 3);
+}
+
+static void test_wait(void)
+{
+    uint8_t const a = HID_KEY_A;
+    uint8_t const keys[] = { HID_KEY_A, 0, HID_KEY_B, HID_KEY_A };
+    recorder_t r;
+    hid_sched_t s;
+
+    // A wait the host could autorepeat in gets the release first
+    memset(&r, 0, sizeof(r));
+    hid_sched_init(&s, record_send, record_delay, &r);
+    hid_sched_press(&s, 0, &a, 1);
+    hid_sched_release(&s);
+    hid_sched_wait(&s, HID_SCHED_HOLD_MAX_MS + 1);
+    hid_sched_flush(&s);
+    expect("long wait", &r, &s, "00:04 00:00 +201", 2);
+
+    // Up to the limit the release waits for the end
+    memset(&r, 0, sizeof(r));
+    hid_sched_init(&s, record_send, record_delay, &r);
+    hid_sched_press(&s, 0, &a, 1);
+    hid_sched_release(&s);
+    hid_sched_wait(&s, HID_SCHED_HOLD_MAX_MS);
+    hid_sched_flush(&s);
+    expect("short wait", &r, &s, "00:04 +200 00:00", 2);
+
+    // Keys of one press share a report, zeroes and duplicates dropped
+    memset(&r, 0, sizeof(r));
+    hid_sched_init(&s, record_send, record_delay, &r);
+    hid_sched_press(&s, 0, keys, sizeof(keys));
+    hid_sched_release(&s);
+    hid_sched_flush(&s);
+    hid_sched_flush(&s);            // Nothing owed the second time
+    expect("chord", &r, &s, "00:04:05 00:00", 2);
+}
+
+/* A failed report is handed back and not taken as sent */
+static void test_error(void)
+{
+    uint8_t const a = HID_KEY_A;
+    recorder_t r;
+    hid_sched_t s;
+    int res;
+
+    memset(&r, 0, sizeof(r));
+    r.fail_at = 1;
+    hid_sched_init(&s, record_send, record_delay, &r);
+    res = hid_sched_press(&s, 0, &a, 1);
+    tests++;
+    if ((res != -1) || (s.keycode[0] != 0)) {
+        failures++;
+        printf("FAIL send error: res %d keycode %02x\n", res, s.keycode[0]);
+    }
+    hid_sched_press(&s, 0, &a, 1);
+    hid_sched_release(&s);
+    hid_sched_flush(&s);
+    expect("send error retry", &r, &s, "00:04 00:00", 2);
+}
+
+int main(void)
+{
+    test_macro();
+    test_type();
+    test_wait();
+    test_error();
+    printf("%d of %d passed\n", tests - failures, tests);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+/* Host stand-in for esp_err.h */
+#ifndef ESP_ERR_H_STUB_
+#define ESP_ERR_H_STUB_
+
+typedef int esp_err_t;
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_NVS_NOT_FOUND   0x1102
+
+static inline const char *esp_err_to_name(esp_err_t err)
+{
+    return err == ESP_OK ? "ESP_OK" : "error";
+}
+
+#endif
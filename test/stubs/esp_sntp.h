@@ -0,0 +1,14 @@
+/* Host stand-in for esp_sntp.h, the tests run without SNTP */
+#ifndef ESP_SNTP_H_STUB_
+#define ESP_SNTP_H_STUB_
+
+#include <sys/time.h>
+
+#define SNTP_OPMODE_POLL    0
+
+static inline void sntp_setoperatingmode(int mode) { (void) mode; }
+static inline void sntp_setservername(int idx, const char *server) { (void) idx; (void) server; }
+static inline void sntp_set_time_sync_notification_cb(void (*cb)(struct timeval *tv)) { (void) cb; }
+static inline void sntp_init(void) { }
+
+#endif
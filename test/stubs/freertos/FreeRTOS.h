@@ -0,0 +1,11 @@
+/* Host stand-in for FreeRTOS, the tests run on one thread */
+#ifndef FREERTOS_H_STUB_
+#define FREERTOS_H_STUB_
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED    0
+#define portENTER_CRITICAL(mux)         ((void) (mux))
+#define portEXIT_CRITICAL(mux)          ((void) (mux))
+#define portMAX_DELAY                   0xffffffffu
+
+#endif
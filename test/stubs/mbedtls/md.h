@@ -0,0 +1,25 @@
+/* Host stand-in for mbedtls/md.h, the tests don't check MACs */
+#ifndef MBEDTLS_MD_H_STUB_
+#define MBEDTLS_MD_H_STUB_
+
+#include <stddef.h>
+#include <string.h>
+
+typedef enum { MBEDTLS_MD_SHA256 } mbedtls_md_type_t;
+typedef struct mbedtls_md_info_t mbedtls_md_info_t;
+
+static inline const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type)
+{
+    (void) type;
+    return NULL;
+}
+
+static inline int mbedtls_md_hmac(const mbedtls_md_info_t *info, const unsigned char *key, size_t keylen,
+                                  const unsigned char *input, size_t ilen, unsigned char *output)
+{
+    (void) info; (void) key; (void) keylen; (void) input; (void) ilen;
+    memset(output, 0, 32);
+    return 0;
+}
+
+#endif
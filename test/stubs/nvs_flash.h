@@ -0,0 +1,20 @@
+/* Host stand-in for nvs_flash.h, each test provides the functions */
+#ifndef NVS_FLASH_H_STUB_
+#define NVS_FLASH_H_STUB_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_commit(nvs_handle_t handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_get_i64(nvs_handle_t handle, const char *key, int64_t *value);
+esp_err_t nvs_set_i64(nvs_handle_t handle, const char *key, int64_t value);
+
+#endif
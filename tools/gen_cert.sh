@@ -0,0 +1,24 @@
+#!/bin/sh
+# Create the HTTPS server certificate and key embedded with WEBKEY_HTTPS.
+#
+#     tools/gen_cert.sh [hostname] [days]
+#
+# An ECDSA P-256 key keeps the full handshake on the ESP32-S2 far cheaper
+# than RSA. The files go to main/certs/, which is not kept in git.
+
+set -e
+
+HOST=${1:-webkey}
+DAYS=${2:-3650}
+DIR=$(dirname "$0")/../main/certs
+
+mkdir -p "$DIR"
+if [ -f "$DIR/prvtkey.pem" ]; then
+    echo "$DIR/prvtkey.pem exists, remove it to make a new key" >&2
+    exit 1
+fi
+
+openssl ecparam -name prime256v1 -genkey -noout -out "$DIR/prvtkey.pem"
+openssl req -new -x509 -sha256 -key "$DIR/prvtkey.pem" -out "$DIR/servercert.pem" \
+    -days "$DAYS" -subj "/CN=$HOST" -addext "subjectAltName=DNS:$HOST"
+echo "Wrote $DIR/servercert.pem and $DIR/prvtkey.pem for $HOST"
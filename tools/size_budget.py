@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Check the firmware image against the size budget in size_budget.json.
+
+    size_budget.py --build build                  report and check
+    size_budget.py --build build --update         refit budgets to this build
+    idf.py size-budget                            the same as a build target
+
+Sizes come from ESP-IDF's idf_size.py (totals per memory section and per
+static library) plus the size of the .bin that is sent over OTA. A budget
+of null is unset and fails the check like an overrun; --update sets every
+budget to the current size plus --headroom percent, except the image
+limit, which is the OTA partition size and is only changed by hand.
+
+Exits 1 if anything is over budget or has no budget.
+"""
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def idf_size(map_file, *options):
+    tool = os.path.join(os.environ.get('IDF_PATH', ''), 'tools', 'idf_size.py')
+    if not os.path.exists(tool):
+        sys.exit('size_budget: idf_size.py not found, is IDF_PATH set?')
+    out = subprocess.check_output([sys.executable, tool, '--json'] + list(options) + [map_file])
+    return json.loads(out)
+
+
+def archive_size(sections):
+    """Bytes an archive contributes, whatever this IDF version calls its sections"""
+    if isinstance(sections.get('total'), int):
+        return sections['total']
+    return sum(v for k, v in sections.items() if isinstance(v, int) and not k.startswith('used'))
+
+
+def measure(build):
+    with open(os.path.join(build, 'project_description.json')) as f:
+        desc = json.load(f)
+    name = desc['project_name']
+    map_file = os.path.join(build, name + '.map')
+    sizes = {'image': os.path.getsize(os.path.join(build, desc.get('app_bin', name + '.bin')))}
+    totals = idf_size(map_file)
+    sections = {k: v for k, v in totals.items() if isinstance(v, int)}
+    archives = {k: archive_size(v) for k, v in idf_size(map_file, '--archives').items()}
+    return sizes, sections, archives
+
+
+def check(kind, measured, budgets, rows):
+    over = 0
+    for name, budget in budgets.items():
+        size = measured.get(name)
+        if size is None:
+            rows.append((kind, name, '-', budget, 'missing'))
+            continue
+        if budget is None:
+            state = 'UNSET'
+            over += 1
+        elif size > budget:
+            state = 'OVER'
+            over += 1
+        else:
+            state = '%.1f%% free' % (100.0 * (budget - size) / budget)
+        rows.append((kind, name, size, budget, state))
+    return over
+
+
+def refit(budgets, measured, headroom, min_archive):
+    fitted = {}
+    for name, size in measured.items():
+        if name in budgets or size >= min_archive:
+            fitted[name] = int(math.ceil(size * (1 + headroom / 100.0) / 1024.0)) * 1024
+    return dict(sorted(fitted.items()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--build', default='build', help='ESP-IDF build directory')
+    parser.add_argument('--budget', default=os.path.join(HERE, 'size_budget.json'))
+    parser.add_argument('--update', action='store_true', help='rewrite budgets from this build')
+    parser.add_argument('--headroom', type=float, default=5.0, help='percent added by --update')
+    parser.add_argument('--min-archive', type=int, default=4096,
+                        help='--update also budgets libraries at least this big')
+    args = parser.parse_args()
+
+    with open(args.budget) as f:
+        budget = json.load(f)
+    sizes, sections, archives = measure(args.build)
+
+    if args.update:
+        budget['sections'] = refit(budget.get('sections', {}), sections, args.headroom, 1 << 62)
+        budget['archives'] = refit(budget.get('archives', {}), archives, args.headroom, args.min_archive)
+        with open(args.budget, 'w') as f:
+            json.dump(budget, f, indent=2)
+            f.write('\n')
+        print('Updated %s' % args.budget)
+
+    rows = []
+    over = check('image', sizes, {'image': budget['image']}, rows)
+    over += check('section', sections, budget.get('sections', {}), rows)
+    over += check('archive', archives, budget.get('archives', {}), rows)
+
+    width = max(len(r[1]) for r in rows)
+    for kind, name, size, limit, state in rows:
+        print('%-8s %-*s %9s %9s  %s' % (kind, width, name, size, '-' if limit is None else limit, state))
+    if over:
+        print('%d over budget or unset' % over)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Page through the webkey audit log.
+
+    webkey_audit.py webkey                 print every record still in flash
+    webkey_audit.py webkey --cursor 1200   start at record 1200
+    webkey_audit.py webkey --follow        keep polling for new records
+
+Records come from GET /audit?cursor=&count=, each page's "next" is the
+cursor for the one after it.
+"""
+
+import argparse
+import json
+import sys
+import time
+import urllib.request
+
+from webkey_proto import STATUS
+
+SEQ_RESULTS = ['ok', 'restart', 'timeout', 'aborted']
+LAYOUTS = ['us', 'uk', 'de']
+POWER_ACTIONS = {1: 'off', 2: 'sleep', 3: 'wake'}
+
+
+def fetch(host, cursor, count, timeout):
+    url = 'http://%s/audit?cursor=%d&count=%d' % (host, cursor, count)
+    with urllib.request.urlopen(url, timeout=timeout) as resp:
+        return json.load(resp)
+
+
+def format_record(r):
+    when = time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(r['time'])) if r['time'] else 'boot+%.3fs' % (r['uptime_ms'] / 1000.0)
+    kind = r['type']
+    if kind == 'boot':
+        what = 'reset reason %d' % r['arg']
+    elif kind == 'seq_end':
+        res = SEQ_RESULTS[r['result']] if r['result'] < len(SEQ_RESULTS) else str(r['result'])
+        what = 'b%d mode %d %s after %d ms' % (r['btn'], r['mode'], res, r['arg'])
+    elif kind == 'type':
+        res = STATUS[r['result']] if r['result'] < len(STATUS) else 'status %d' % r['result']
+        layout = LAYOUTS[r['mode']] if r['mode'] < len(LAYOUTS) else str(r['mode'])
+        what = '%d chars layout %s %s%s' % (r['arg'], layout, res, ' signed' if r['signed'] else '')
+    elif kind in ('power', 'consumer'):
+        res = STATUS[r['result']] if r['result'] < len(STATUS) else 'status %d' % r['result']
+        code = POWER_ACTIONS.get(r['mode'], str(r['mode'])) if kind == 'power' else '0x%02X' % r['arg']
+        what = '%s %s%s' % (code, res, ' signed' if r['signed'] else '')
+    else:
+        res = STATUS[r['result']] if r['result'] < len(STATUS) else 'status %d' % r['result']
+        what = 'b%d mode %d %s%s' % (r['btn'], r['mode'], res, ' signed' if r['signed'] else '')
+    who = r['source'] if r['addr'] == '0.0.0.0' else '%s %s' % (r['source'], r['addr'])
+    return '%8d  %-22s %4d  %-8s %-22s %s' % (r['seq'], when, r['boot'], kind, who, what)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='webkey address, host[:port]')
+    parser.add_argument('--cursor', type=int, default=0, help='first record number, 0 for the oldest')
+    parser.add_argument('--count', type=int, default=64, help='records per request')
+    parser.add_argument('--follow', action='store_true', help='poll for new records')
+    parser.add_argument('--interval', type=float, default=2.0)
+    parser.add_argument('--timeout', type=float, default=5.0)
+    args = parser.parse_args()
+
+    cursor = args.cursor
+    try:
+        while True:
+            page = fetch(args.host, cursor, args.count, args.timeout)
+            if page['first'] > cursor > 0:
+                print('# records %d to %d were overwritten' % (cursor, page['first'] - 1))
+            for r in page['records']:
+                print(format_record(r))
+            cursor = page['next']
+            if page['records']:
+                continue
+            if not args.follow:
+                break
+            time.sleep(args.interval)
+    except (OSError, ValueError, KeyError) as e:
+        sys.exit('webkey_audit: %s' % e)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
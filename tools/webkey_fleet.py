@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Trigger a boot selection on many webkeys at once.
+
+Reads an inventory with one device per line:
+
+    host[:port] [key] [wait]
+
+e.g. "rack1-node3 b2 led". Blank lines and '#' comments are ignored; the
+key and wait columns default to the command line options. All devices are
+contacted concurrently and each device's result (Okay, Busy, Bad Selection,
+timeout or error) is printed with its timing, followed by the total wall time.
+"""
+
+import argparse
+import asyncio
+import json
+import sys
+import time
+
+import webkey_proto as proto
+
+
+def parse_inventory(path, default_key, default_wait):
+    devices = []
+    with open(path) as f:
+        for line in f:
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+            fields = line.split()
+            host = fields[0]
+            key = fields[1] if len(fields) > 1 else default_key
+            wait = fields[2] if len(fields) > 2 else default_wait
+            devices.append((host, key, wait))
+    return devices
+
+
+def split_host(host, default_port=80):
+    if host.count(':') == 1:
+        name, port = host.split(':')
+        return name, int(port)
+    return host, default_port
+
+
+async def post(host, path, timeout, device_key=None):
+    """Send one POST, return (status code, body, connect ms, total ms)"""
+    name, port = split_host(host)
+    auth = ''.join('%s: %s\r\n' % h for h in proto.http_auth_headers(device_key, 'POST', path).items())
+    start = time.perf_counter()
+    reader, writer = await asyncio.wait_for(asyncio.open_connection(name, port), timeout)
+    connected = time.perf_counter()
+    try:
+        writer.write(('POST %s HTTP/1.1\r\nHost: %s\r\nContent-Length: 0\r\n%s'
+                      'Connection: close\r\n\r\n' % (path, name, auth)).encode())
+        await writer.drain()
+        data = await asyncio.wait_for(reader.read(), timeout - (connected - start))
+    finally:
+        writer.close()
+    done = time.perf_counter()
+    head, _, body = data.partition(b'\r\n\r\n')
+    status = int(head.split(b' ', 2)[1]) if head.startswith(b'HTTP/') else 0
+    return status, body.decode(errors='replace').strip(), \
+        (connected - start) * 1000, (done - start) * 1000
+
+
+async def trigger(device, timeout, sem, device_key):
+    host, key, wait = device
+    path = '/ctrl?key=' + key + ('&wait=' + wait if wait else '')
+    async with sem:
+        start = time.perf_counter()
+        try:
+            status, body, connect_ms, total_ms = await post(host, path, timeout, device_key)
+            result = body if status == 200 else 'HTTP %d %s' % (status, body)
+        except asyncio.TimeoutError:
+            result, connect_ms, total_ms = 'timeout', None, (time.perf_counter() - start) * 1000
+        except OSError as e:
+            result, connect_ms, total_ms = 'error: %s' % (e.strerror or e), None, \
+                (time.perf_counter() - start) * 1000
+    return {'host': host, 'key': key, 'wait': wait, 'result': result,
+            'connect_ms': connect_ms, 'total_ms': total_ms}
+
+
+async def run(devices, timeout, limit, device_key):
+    sem = asyncio.Semaphore(limit if limit > 0 else len(devices) or 1)
+    return await asyncio.gather(*(trigger(d, timeout, sem, device_key) for d in devices))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('inventory', help='inventory file, one device per line')
+    parser.add_argument('--key', default='b1', help='default selection (b1..b4)')
+    parser.add_argument('--wait', default='', help='default wait mode, e.g. led')
+    parser.add_argument('--timeout', type=float, default=5.0, help='per device timeout (s)')
+    parser.add_argument('--limit', type=int, default=0, help='max concurrent requests, 0 = all')
+    parser.add_argument('--json', action='store_true', help='print results as JSON')
+    parser.add_argument('--device-key', default='', help='device key for signed requests, 64 hex digits')
+    args = parser.parse_args()
+
+    devices = parse_inventory(args.inventory, args.key, args.wait)
+    device_key = proto.parse_key(args.device_key)
+    start = time.perf_counter()
+    results = asyncio.run(run(devices, args.timeout, args.limit, device_key))
+    wall_ms = (time.perf_counter() - start) * 1000
+
+    counts = {}
+    for r in results:
+        counts[r['result']] = counts.get(r['result'], 0) + 1
+
+    if args.json:
+        json.dump({'results': results, 'counts': counts, 'wall_ms': wall_ms}, sys.stdout, indent=1)
+        print()
+    else:
+        width = max([len(r['host']) for r in results] + [4])
+        print('%-*s  %-4s  %9s  %9s  %s' % (width, 'host', 'key', 'conn ms', 'total ms', 'result'))
+        for r in results:
+            conn = '%9.1f' % r['connect_ms'] if r['connect_ms'] is not None else '%9s' % '-'
+            print('%-*s  %-4s  %s  %9.1f  %s' % (width, r['host'], r['key'], conn, r['total_ms'], r['result']))
+        print()
+        print(', '.join('%s: %d' % kv for kv in sorted(counts.items())))
+        print('%d devices in %.1f ms wall time' % (len(results), wall_ms))
+
+    return 0 if counts.get('Okay', 0) == len(results) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Upload a firmware image to a webkey and report where the time went.
+
+    webkey_ota.py webkey build/webkey.bin
+    webkey_ota.py webkey:443 build/webkey.bin --https --chunk 1460 --device-key KEY
+    webkey_ota.py 127.0.0.1:8080 image.bin --chunk 65536 --repeat 3
+
+The image is sent as POST /update in writes of --chunk bytes (optionally
+--gap ms apart) and the end-to-end rate is printed. The device answers with
+its own per-chunk timing: httpd_req_recv versus esp_ota_write, each as a
+log2 histogram of microseconds, plus the receive timeouts it retried. The
+same numbers stay under "ota" in /status until the next update.
+
+An upload makes the new image bootable (it is not restarted), so use an
+image you mean to run. A keyed device still writes an unsigned upload but
+answers 401 and never boots it; its timing is then only in /status.
+"""
+
+import argparse
+import http.client
+import json
+import ssl
+import sys
+import time
+
+import webkey_proto as proto
+
+
+def split_host(host, default_port):
+    if host.count(':') == 1:
+        name, port = host.split(':')
+        return name, int(port)
+    return host, default_port
+
+
+def connect(args):
+    name, port = split_host(args.host, 443 if args.https else 80)
+    if not args.https:
+        return http.client.HTTPConnection(name, port, timeout=args.timeout)
+    ctx = ssl.create_default_context(cafile=args.cafile) if args.cafile else ssl._create_unverified_context()
+    return http.client.HTTPSConnection(name, port, timeout=args.timeout, context=ctx)
+
+
+def upload(args, image, key):
+    headers = {'Content-Type': 'application/octet-stream', 'Content-Length': str(len(image))}
+    headers.update(proto.http_auth_headers(key, 'POST', '/update', image))
+    start = time.perf_counter()
+    conn = connect(args)
+    try:
+        conn.putrequest('POST', '/update')
+        for name, value in headers.items():
+            conn.putheader(name, value)
+        conn.endheaders()
+        sent = time.perf_counter()
+        for offset in range(0, len(image), args.chunk):
+            conn.send(image[offset:offset + args.chunk])
+            if args.gap:
+                time.sleep(args.gap / 1000)
+        sent = time.perf_counter() - sent
+        resp = conn.getresponse()
+        body = resp.read()
+    finally:
+        conn.close()
+    return resp.status, body, time.perf_counter() - start, sent
+
+
+def histogram(name, timing, min_us):
+    lines = ['  %-5s %5d chunks %8d ms total, max %d us' % (name, timing['chunks'], timing['ms'], timing['max_us'])]
+    for i, count in enumerate(timing['hist']):
+        if count:
+            low = 0 if i == 0 else min_us << (i - 1)
+            lines.append('        %7d us+  %5d' % (low, count))
+    return '\n'.join(lines)
+
+
+def report(ota, elapsed):
+    print('  device %d bytes in %d ms (%.2f MB/s), result %s' % (
+        ota['bytes'], ota['ms'], ota['bytes'] / max(ota['ms'], 1) / 1000, ota['result']))
+    print('  recv timeouts retried %d (%d ms)' % (ota['timeouts'], ota['timeout_ms']))
+    print(histogram('recv', ota['recv'], ota['hist_min_us']))
+    print(histogram('write', ota['write'], ota['hist_min_us']))
+    other = ota['ms'] - ota['recv']['ms'] - ota['write']['ms'] - ota['timeout_ms']
+    print('  other (auth, finish, scheduling) %d ms, host round trip %d ms' % (other, elapsed * 1000 - ota['ms']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='webkey address, host[:port]')
+    parser.add_argument('image', help='firmware image (.bin)')
+    parser.add_argument('--chunk', type=int, default=4096, help='bytes per socket write')
+    parser.add_argument('--gap', type=float, default=0.0, help='ms to pause between writes')
+    parser.add_argument('--repeat', type=int, default=1, help='number of uploads')
+    parser.add_argument('--https', action='store_true', help='upload over HTTPS (required with WEBKEY_HTTPS)')
+    parser.add_argument('--cafile', help='verify against this certificate (main/certs/servercert.pem)')
+    parser.add_argument('--device-key', default='', help='device key, 64 hex digits')
+    parser.add_argument('--timeout', type=float, default=60.0)
+    args = parser.parse_args()
+
+    key = proto.parse_key(args.device_key)
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    if not image or args.chunk < 1:
+        parser.error('need a non-empty image and a positive --chunk')
+
+    rates = []
+    for run in range(args.repeat):
+        try:
+            status, body, elapsed, sent = upload(args, image, key)
+        except (OSError, http.client.HTTPException) as e:
+            print('run %d: %s' % (run + 1, e), file=sys.stderr)
+            return 1
+        rate = len(image) / elapsed / 1e6
+        rates.append(rate)
+        print('run %d: HTTP %d, %d bytes in %.2f s (%.3f MB/s), sending took %.2f s' % (
+            run + 1, status, len(image), elapsed, rate, sent))
+        try:
+            report(json.loads(body)['ota'], elapsed)
+        except (ValueError, KeyError, TypeError):
+            print('  ' + body.decode(errors='replace').strip())
+        if status != 200:
+            return 1
+    if len(rates) > 1:
+        print('MB/s min %.3f  mean %.3f  max %.3f' % (min(rates), sum(rates) / len(rates), max(rates)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,108 @@
+"""Binary control protocol of the webkey, see main/ctrl_proto.h, and the
+signature on HTTP requests, see req_auth_finish() in main/web_server.c"""
+
+import hashlib
+import hmac
+import os
+import struct
+import time
+
+MAGIC = 0x4B57
+VERSION = 1
+AUTH_LEN = 16
+DEFAULT_PORT = 7531
+
+CMD_PING, CMD_CTRL, CMD_ARM, CMD_DISARM = range(4)
+COMMANDS = {'ping': CMD_PING, 'ctrl': CMD_CTRL, 'arm': CMD_ARM, 'disarm': CMD_DISARM}
+
+STATUS = ['Okay', 'Busy', 'Bad Selection', 'Auth Failed', 'Replay', 'Bad Request', 'Error']
+ST_OK, ST_BUSY, ST_BAD_SELECTION, ST_AUTH, ST_REPLAY, ST_BAD_REQUEST, ST_ERROR = range(len(STATUS))
+
+MODES = {'': 0, 'blind': 0, 'led': 1}
+
+# magic, version, cmd, seq, button, mode, reserved[6]
+_REQUEST = struct.Struct('<HBBIBB6x')
+# magic, version, cmd, seq, status, busy, armed, floor, reserved[1]
+_REPLY = struct.Struct('<HBBIBBBIx')
+SIZE = 32
+
+
+def parse_key(hexkey):
+    """Device key as bytes, None for an open device"""
+    if not hexkey:
+        return None
+    key = bytes.fromhex(hexkey)
+    if len(key) != 32:
+        raise ValueError('device key must be 64 hex digits')
+    return key
+
+
+def _mac(key, data):
+    if key is None:
+        return bytes(AUTH_LEN)
+    return hmac.new(key, data, hashlib.sha256).digest()[:AUTH_LEN]
+
+
+def pack_request(cmd, seq, button=0, mode=0, key=None):
+    head = _REQUEST.pack(MAGIC, VERSION, cmd, seq & 0xffffffff, button, mode)
+    return head + _mac(key, head)
+
+
+def unpack_request(data):
+    magic, version, cmd, seq, button, mode = _REQUEST.unpack(data[:16])
+    return {'magic': magic, 'version': version, 'cmd': cmd, 'seq': seq,
+            'button': button, 'mode': mode, 'auth': data[16:SIZE]}
+
+
+def seq_newer(seq, than):
+    """Sequence numbers compare like the device does, modulo 2^32"""
+    return 0 < ((seq - than) & 0xffffffff) < 0x80000000
+
+
+def pack_reply(cmd, seq, status, busy=0, armed=0, key=None, floor=0):
+    head = _REPLY.pack(MAGIC, VERSION, cmd, seq, status, busy, armed, floor & 0xffffffff)
+    return head + _mac(key, head)
+
+
+def unpack_reply(data, key=None):
+    """Decode a reply, raises ValueError if it is malformed or not authentic"""
+    if len(data) != SIZE:
+        raise ValueError('bad reply length %d' % len(data))
+    magic, version, cmd, seq, status, busy, armed, floor = _REPLY.unpack(data[:16])
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('bad reply header')
+    if key is not None and not hmac.compare_digest(_mac(key, data[:16]), data[16:SIZE]):
+        raise ValueError('reply authenticator mismatch')
+    return {'cmd': cmd, 'seq': seq, 'status': status, 'busy': busy, 'armed': armed, 'floor': floor,
+            'result': STATUS[status] if status < len(STATUS) else 'status %d' % status}
+
+
+def verify_request(data, key):
+    return key is None or hmac.compare_digest(_mac(key, data[:16]), data[16:SIZE])
+
+
+def http_auth_headers(key, method, path, body=b'', ts=None, nonce=None):
+    """X-Webkey-* headers signing one HTTP request, empty for an open device"""
+    if key is None:
+        return {}
+    ts = str(int(time.time()) if ts is None else ts)
+    nonce = nonce or os.urandom(8).hex()
+    msg = '\n'.join([method, path, ts, nonce, hashlib.sha256(body).hexdigest()])
+    return {'X-Webkey-Time': ts, 'X-Webkey-Nonce': nonce,
+            'X-Webkey-Auth': hmac.new(key, msg.encode(), hashlib.sha256).hexdigest()}
+
+
+def check_http_auth(key, method, path, headers, body):
+    """Authenticate a request as the device does, returns (ts, nonce) or raises ValueError.
+    headers must have lower case names."""
+    try:
+        ts, nonce = headers['x-webkey-time'], headers['x-webkey-nonce']
+        mac = bytes.fromhex(headers['x-webkey-auth'])
+        int(ts)
+        bytes.fromhex(nonce)
+    except (KeyError, ValueError):
+        raise ValueError('Signature required')
+    expect = http_auth_headers(key, method, path, body, ts, nonce)['X-Webkey-Auth']
+    if not hmac.compare_digest(bytes.fromhex(expect), mac):
+        raise ValueError('Bad signature')
+    return int(ts), nonce
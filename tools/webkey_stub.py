@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Local stand-ins for webkeys, for exercising the host tools.
+
+Starts COUNT HTTP servers on consecutive ports that answer POST /ctrl the
+way ctrl_post_handler does: "Okay" for a valid selection, "Busy" while the
+previous sequence is still being typed, "Bad Selection" otherwise. POST
+/update is swallowed and answered with OTA timing in the device's format. Each stub
+also answers the binary control protocol on the UDP port with the same
+number. With --device-key, HTTP requests must be signed and UDP requests
+authenticated, as on a device with a key set. An inventory listing the
+stubs can be written for webkey_fleet.py.
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import sys
+import time
+from urllib.parse import urlsplit, parse_qs
+
+import webkey_proto as proto
+
+
+AUTH_WINDOW = 30   # WEBKEY_AUTH_WINDOW
+
+
+class Stub(asyncio.DatagramProtocol):
+    def __init__(self, busy_time, latency, key):
+        self.busy_until = 0.0
+        self.busy = 0
+        self.busy_time = busy_time
+        self.latency = latency
+        self.key = key
+        self.last_seq = 0
+        self.nonces = {}
+        self.transport = None
+
+    def authenticate(self, method, target, headers, body):
+        """None if the request may proceed, else the reason, like req_auth_finish()"""
+        if self.key is None:
+            return None
+        try:
+            ts, nonce = proto.check_http_auth(self.key, method, target, headers, body)
+        except ValueError as e:
+            return str(e)
+        now = time.time()
+        self.nonces = {n: t for n, t in self.nonces.items() if t >= now - AUTH_WINDOW}
+        if abs(ts - now) > AUTH_WINDOW:
+            return 'Stale request'
+        if nonce in self.nonces:
+            return 'Replayed request'
+        self.nonces[nonce] = ts
+        return None
+
+    def command(self, button, mode):
+        """Same decisions as hid_command()"""
+        loop = asyncio.get_running_loop()
+        if loop.time() < self.busy_until:
+            return proto.ST_BUSY
+        self.busy = 0
+        if button not in (1, 2, 3, 4) or mode not in (0, 1):
+            return proto.ST_BAD_SELECTION
+        self.busy = button
+        self.busy_until = loop.time() + self.busy_time
+        return proto.ST_OK
+
+    def ctrl(self, query):
+        q = parse_qs(query)
+        key = q.get('key', [''])[0]
+        wait = q.get('wait', [''])[0]
+        button = int(key[1:]) if key[:1] == 'b' and key[1:].isdigit() else 0
+        status = self.command(button, proto.MODES.get(wait, -1))
+        return proto.STATUS[status] + '\n'
+
+    def update(self, length, elapsed):
+        """Timing as update_post_handler reports it, nothing is measured per chunk"""
+        ms = int(elapsed * 1000)
+        timing = {'chunks': 0, 'ms': 0, 'max_us': 0, 'hist': [0] * 16}
+        return json.dumps({'ota': {'result': 'ESP_OK', 'bytes': length, 'ms': ms,
+                                   'kbps': length * 8 // max(ms, 1), 'timeouts': 0, 'timeout_ms': 0,
+                                   'hist_min_us': 128, 'recv': timing, 'write': timing}}) + '\n'
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        if len(data) != proto.SIZE:
+            return
+        req = proto.unpack_request(data)
+        if req['magic'] != proto.MAGIC or req['version'] != proto.VERSION:
+            status = proto.ST_BAD_REQUEST
+        elif not proto.verify_request(data, self.key):
+            status = proto.ST_AUTH
+        elif self.key is not None and not proto.seq_newer(req['seq'], self.last_seq):
+            status = proto.ST_REPLAY
+        else:
+            if self.key is not None:
+                self.last_seq = req['seq']
+            if req['cmd'] == proto.CMD_PING:
+                status = proto.ST_OK
+            elif req['cmd'] == proto.CMD_CTRL:
+                status = self.command(req['button'], req['mode'])
+            else:
+                status = proto.ST_BAD_REQUEST
+        reply = proto.pack_reply(req['cmd'], req['seq'], status,
+                                 self.busy if asyncio.get_running_loop().time() < self.busy_until else 0,
+                                 0, self.key, self.last_seq)
+        if self.latency:
+            asyncio.get_running_loop().call_later(random.uniform(0, self.latency),
+                                                  self.transport.sendto, reply, addr)
+        else:
+            self.transport.sendto(reply, addr)
+
+    async def handle(self, reader, writer):
+        try:
+            while True:
+                request = await reader.readline()
+                if not request:
+                    break
+                headers = {}
+                while True:
+                    line = await reader.readline()
+                    if line in (b'\r\n', b'\n', b''):
+                        break
+                    name, _, value = line.decode().partition(':')
+                    headers[name.strip().lower()] = value.strip()
+                length = int(headers.get('content-length', 0))
+                start = time.monotonic()
+                body = await reader.readexactly(length) if length else b''
+
+                method, target, _ = request.decode().split(' ', 2)
+                url = urlsplit(target)
+                if self.latency:
+                    await asyncio.sleep(random.uniform(0, self.latency))
+                denied = self.authenticate(method, target, headers, body) if method == 'POST' else None
+                if denied:
+                    status, body = '401 Unauthorized', denied
+                elif method == 'POST' and url.path == '/ctrl':
+                    status, body = '200 OK', self.ctrl(url.query)
+                elif method == 'POST' and url.path == '/update':
+                    status, body = '200 OK', self.update(length, time.monotonic() - start)
+                else:
+                    status, body = '404 Not Found', 'File does not exist'
+
+                close = headers.get('connection', '').lower() == 'close'
+                writer.write(('HTTP/1.1 %s\r\nContent-Type: text/html\r\nContent-Length: %d\r\n%s\r\n%s'
+                              % (status, len(body), 'Connection: close\r\n' if close else '', body)).encode())
+                await writer.drain()
+                if close:
+                    break
+        except (ConnectionError, ValueError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            writer.close()
+
+
+async def serve(args):
+    servers = []
+    key = proto.parse_key(args.device_key)
+    loop = asyncio.get_running_loop()
+    for i in range(args.count):
+        stub = Stub(args.busy_time, args.latency, key)
+        servers.append(await asyncio.start_server(stub.handle, args.host, args.port + i))
+        await loop.create_datagram_endpoint(lambda: stub, local_addr=(args.host, args.port + i))
+    if args.inventory:
+        with open(args.inventory, 'w') as f:
+            for i in range(args.count):
+                f.write('%s:%d\n' % (args.host, args.port + i))
+    print('%d stubs listening on %s:%d-%d' % (args.count, args.host, args.port,
+                                              args.port + args.count - 1), flush=True)
+    await asyncio.gather(*(s.serve_forever() for s in servers))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--count', type=int, default=10, help='number of stub devices')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8080, help='first port')
+    parser.add_argument('--busy-time', type=float, default=17.0,
+                        help='seconds a sequence keeps the stub busy')
+    parser.add_argument('--latency', type=float, default=0.0,
+                        help='max random response delay (s), emulates WiFi latency')
+    parser.add_argument('--inventory', help='write an inventory of the stubs to this file')
+    parser.add_argument('--device-key', default='', help='device key, 64 hex digits')
+    args = parser.parse_args()
+    try:
+        asyncio.run(serve(args))
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
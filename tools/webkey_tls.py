@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Measure HTTPS handshake cost on a webkey built with WEBKEY_HTTPS.
+
+    webkey_tls.py webkey --count 10
+    webkey_tls.py webkey --cafile main/certs/servercert.pem
+
+Three cases are timed, each ending with GET /status:
+    full        new TCP connection and a full TLS handshake
+    resumed     new TCP connection resuming the previous session (ticket)
+    keepalive   another request on an open TLS connection
+
+If 'resumed' reports reused=0 the device was built without
+ESP_TLS_SERVER_SESSION_TICKETS and every connection pays the full cost.
+"""
+
+import argparse
+import socket
+import ssl
+import statistics
+import sys
+import time
+
+
+def split_host(host, default_port):
+    if host.count(':') == 1:
+        name, port = host.split(':')
+        return name, int(port)
+    return host, default_port
+
+
+def make_context(args):
+    ctx = ssl.create_default_context(cafile=args.cafile) if args.cafile else ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    if not args.cafile:
+        ctx.check_hostname = False
+        ctx.verify_mode = ssl.CERT_NONE
+    # The device's mbedTLS speaks TLS 1.2, where tickets are issued in the handshake
+    ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+    return ctx
+
+
+def connect(ctx, addr, name, timeout, session=None):
+    start = time.perf_counter()
+    sock = socket.create_connection(addr, timeout=timeout)
+    tls = ctx.wrap_socket(sock, server_hostname=name, session=session)
+    return tls, (time.perf_counter() - start) * 1000
+
+
+def get_status(tls, name):
+    tls.sendall(('GET /status HTTP/1.1\r\nHost: %s\r\n\r\n' % name).encode())
+    head = b''
+    while b'\r\n\r\n' not in head:
+        chunk = tls.recv(4096)
+        if not chunk:
+            raise ConnectionError('connection closed')
+        head += chunk
+    header, body = head.split(b'\r\n\r\n', 1)
+    length = 0
+    for line in header.split(b'\r\n')[1:]:
+        key, _, value = line.partition(b':')
+        if key.strip().lower() == b'content-length':
+            length = int(value)
+    while len(body) < length:
+        body += tls.recv(4096)
+
+
+def summary(name, samples, extra=''):
+    return '%-10s n=%-3d min %8.1f  median %8.1f  max %8.1f ms %s' % (
+        name, len(samples), min(samples), statistics.median(samples), max(samples), extra)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='webkey address, host[:https port]')
+    parser.add_argument('--count', type=int, default=10, help='connections per case')
+    parser.add_argument('--cafile', help='verify against this certificate (main/certs/servercert.pem)')
+    parser.add_argument('--timeout', type=float, default=20.0)
+    args = parser.parse_args()
+
+    name, port = split_host(args.host, 443)
+    ctx = make_context(args)
+
+    full, resumed, keepalive = [], [], []
+    reused = 0
+    session = None
+    try:
+        addr = (socket.gethostbyname(name), port)
+        for _ in range(args.count):
+            tls, ms = connect(ctx, addr, name, args.timeout)
+            get_status(tls, name)
+            full.append(ms)
+            session = tls.session
+            tls.close()
+
+            tls, ms = connect(ctx, addr, name, args.timeout, session)
+            get_status(tls, name)
+            resumed.append(ms)
+            reused += tls.session_reused
+
+            start = time.perf_counter()
+            get_status(tls, name)
+            keepalive.append((time.perf_counter() - start) * 1000)
+            tls.close()
+    except (OSError, ssl.SSLError) as e:
+        sys.exit('webkey_tls: %s' % e)
+
+    print(summary('full', full, '(handshake)'))
+    print(summary('resumed', resumed, '(handshake, reused=%d)' % reused))
+    print(summary('keepalive', keepalive, '(GET /status)'))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Download and decode the webkey binary trace ring.
+
+    webkey_trace.py webkey                 fetch http://webkey/trace and print it
+    webkey_trace.py --file trace.bin       decode a saved download
+    webkey_trace.py webkey --save trace.bin
+
+Event names and formats come from main/trace.h, so the decoder follows the
+firmware without edits. Times are relative to the download, in ms.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+import urllib.request
+
+HEADER = struct.Struct('<IHHIII')
+RECORD = struct.Struct('<IHHII')
+MAGIC = 0x52544B57
+
+MAIN = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'main')
+
+
+def parse_enum(path, prefix, exclude='$^'):
+    """Map value -> (name, trailing comment) for 'PREFIX_NAME [= n], // comment' lines."""
+    names = {}
+    value = -1
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'\s*' + prefix + r'(?!' + exclude + r')(\w+)\s*(?:=\s*(\d+))?\s*,\s*(?://\s*(.*))?', line)
+            if not m:
+                continue
+            value = int(m.group(2)) if m.group(2) else value + 1
+            names[value] = (m.group(1), (m.group(3) or '').strip())
+    return names
+
+
+class Decoder:
+    def __init__(self, src):
+        self.events = parse_enum(os.path.join(src, 'trace.h'), 'TRACE_', 'URI_')
+        self.uris = {v: n.lower() for v, (n, _) in parse_enum(os.path.join(src, 'trace.h'), 'TRACE_URI_').items()}
+        self.hidev = {v: n.lower() for v, (n, _) in parse_enum(os.path.join(src, 'hid_task.h'), 'HID_EV_').items()}
+
+    def format(self, ident, a0, a1, a2):
+        name, fmt = self.events.get(ident, ('EVENT_%d' % ident, 'a0=%a0 a1=%a1 a2=%a2'))
+        text = fmt.replace('%uri', self.uris.get(a0, str(a0)))
+        text = text.replace('%hidev', self.hidev.get(a0, str(a0)))
+        for arg, val in (('%a0', a0), ('%a1', a1), ('%a2', a2)):
+            text = text.replace(arg, str(val))
+        return name.lower(), text
+
+
+def decode(data, decoder):
+    magic, version, size, count, head, now = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError('not a webkey trace')
+    if size < RECORD.size:
+        raise ValueError('record size %d too small' % size)
+    print('# version %d, %d of %d records' % (version, count, head))
+    offset = HEADER.size
+    for _ in range(count):
+        if offset + size > len(data):
+            break
+        time, ident, a0, a1, a2 = RECORD.unpack_from(data, offset)
+        offset += size
+        if ident == 0:
+            continue    # Overwritten during download
+        age = ((now - time) & 0xffffffff) / 1000.0
+        name, text = decoder.format(ident, a0, a1, a2)
+        print('%12.3f  %-16s %s' % (-age, name, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', nargs='?', help='webkey address, host[:port]')
+    parser.add_argument('--file', help='decode a saved trace instead of downloading')
+    parser.add_argument('--save', help='also write the raw download here')
+    parser.add_argument('--src', default=MAIN, help='firmware source directory with trace.h')
+    parser.add_argument('--timeout', type=float, default=5.0)
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, 'rb') as f:
+            data = f.read()
+    elif args.host:
+        with urllib.request.urlopen('http://%s/trace' % args.host, timeout=args.timeout) as resp:
+            data = resp.read()
+    else:
+        parser.error('need a host or --file')
+
+    if args.save:
+        with open(args.save, 'wb') as f:
+            f.write(data)
+    try:
+        decode(data, Decoder(args.src))
+    except (ValueError, struct.error) as e:
+        sys.exit('webkey_trace: %s' % e)
+
+
+if __name__ == '__main__':
+    main()
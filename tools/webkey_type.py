@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Type text on the host through a webkey and report the rate.
+
+    webkey_type.py webkey 'set root=(hd0,gpt2)\\n' --escapes
+    webkey_type.py webkey --prompt --layout de --device-key KEY
+    webkey_type.py webkey --file line.txt --gap 5
+
+The text goes to POST /type?layout=&gap= and is typed once the host is
+listening. --prompt reads it without echo (for a disk passphrase) and adds
+Enter. The tool then polls /status until the device is idle and prints the
+characters, reports and characters per second it measured.
+"""
+
+import argparse
+import getpass
+import http.client
+import json
+import sys
+import time
+
+import webkey_proto as proto
+
+
+def split_host(host, default_port):
+    if host.count(':') == 1:
+        name, port = host.split(':')
+        return name, int(port)
+    return host, default_port
+
+
+def request(args, method, path, body=b'', key=None):
+    name, port = split_host(args.host, 80)
+    conn = http.client.HTTPConnection(name, port, timeout=args.timeout)
+    headers = {'Content-Type': 'text/plain'} if body else {}
+    headers.update(proto.http_auth_headers(key, method, path, body))
+    try:
+        conn.request(method, path, body=body, headers=headers)
+        resp = conn.getresponse()
+        return resp.status, resp.read()
+    finally:
+        conn.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='webkey address, host[:port]')
+    parser.add_argument('text', nargs='?', help='text to type')
+    parser.add_argument('--file', help='type the contents of this file')
+    parser.add_argument('--prompt', action='store_true', help='read the text without echo and add Enter')
+    parser.add_argument('--escapes', action='store_true', help=r'turn \n and \t in the text into Enter and Tab')
+    parser.add_argument('--layout', default='us', help='host keyboard layout: us, uk or de')
+    parser.add_argument('--gap', type=int, default=0, help='ms after every report, for slow firmware')
+    parser.add_argument('--device-key', default='', help='device key, 64 hex digits')
+    parser.add_argument('--timeout', type=float, default=70.0, help='s to wait for the host to take the text')
+    args = parser.parse_args()
+
+    if args.prompt:
+        text = getpass.getpass('Text: ') + '\n'
+    elif args.file:
+        with open(args.file) as f:
+            text = f.read()
+    elif args.text is not None:
+        text = args.text
+    else:
+        parser.error('need text, --file or --prompt')
+    if args.escapes:
+        text = text.replace('\\n', '\n').replace('\\t', '\t')
+
+    key = proto.parse_key(args.device_key)
+    path = '/type?layout=%s&gap=%d' % (args.layout, args.gap)
+    try:
+        status, body = request(args, 'POST', path, text.encode(), key)
+        print('HTTP %d: %s' % (status, body.decode(errors='replace').strip()))
+        if status != 200 or not body.startswith(b'Okay'):
+            return 1
+
+        deadline = time.monotonic() + args.timeout
+        while time.monotonic() < deadline:
+            time.sleep(0.2)
+            usb = json.loads(request(args, 'GET', '/status')[1])['usb']
+            if not usb['busy']:
+                break
+        else:
+            print('still typing after %.0f s' % args.timeout)
+            return 1
+    except (OSError, http.client.HTTPException, ValueError, KeyError) as e:
+        sys.exit('webkey_type: %s' % e)
+
+    t = usb['type']
+    print('%s: %d chars in %d reports, %d ms, %d chars/s (layout %s)' % (
+        t['result'], t['chars'], t['reports'], t['ms'], t['cps'], t['layout']))
+    return 0 if t['result'] == 'ok' else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
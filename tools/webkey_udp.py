@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""Send binary control requests to a webkey, or benchmark them against HTTP.
+
+    webkey_udp.py webkey ctrl b2 [--wait led]
+    webkey_udp.py webkey ping
+    webkey_udp.py webkey bench --count 200
+    webkey_udp.py webkey psbench --count 50 --gap 0.3
+
+bench measures the round trip of the full control dispatch on both paths
+without typing anything: a ctrl request for an invalid button over UDP,
+and POST /ctrl?key=b0 over HTTP, both of which end in "Bad Selection".
+
+psbench switches the device through each WiFi power-save profile and
+measures the UDP round trip in each, pausing --gap seconds between
+requests so the modem has time to sleep as it would between real
+commands. The original profile is restored afterwards.
+"""
+
+import argparse
+import socket
+import statistics
+import sys
+import time
+import http.client
+import json
+
+import webkey_proto as proto
+
+
+def split_host(host, default_port):
+    if host.count(':') == 1:
+        name, port = host.split(':')
+        return name, int(port)
+    return host, default_port
+
+
+def new_seq():
+    # Time based so a restarted client is still newer than the last request
+    return int(time.time() * 1000) & 0xffffffff
+
+
+class UdpClient:
+    def __init__(self, host, port, key, timeout):
+        self.addr = (socket.gethostbyname(host), port)
+        self.key = key
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(timeout)
+        self.seq = new_seq()
+
+    def request(self, cmd, button=0, mode=0, retries=2):
+        jumped = False
+        for _ in range(retries + 1):
+            seq = new_seq()
+            self.seq = seq if proto.seq_newer(seq, self.seq) else (self.seq + 1) & 0xffffffff
+            self.sock.sendto(proto.pack_request(cmd, self.seq, button, mode, self.key), self.addr)
+            try:
+                while True:
+                    data, _ = self.sock.recvfrom(64)
+                    reply = proto.unpack_reply(data, self.key)
+                    if reply['seq'] != self.seq:
+                        continue
+                    # The device keeps its floor across reboots and signs it, start above it once
+                    if reply['status'] == proto.ST_REPLAY and self.key is not None and not jumped:
+                        self.seq = reply['floor']
+                        jumped = True
+                        break
+                    return reply
+            except socket.timeout:
+                continue
+        raise TimeoutError('no reply from %s:%d' % self.addr)
+
+
+def http_ctrl(conn, path, key=None):
+    headers = {'Content-Length': '0'}
+    headers.update(proto.http_auth_headers(key, 'POST', path))
+    conn.request('POST', path, headers=headers)
+    resp = conn.getresponse()
+    return resp.read().decode().strip()
+
+
+def summary(name, samples):
+    samples = sorted(samples)
+    p95 = samples[int(len(samples) * 0.95) - 1] if len(samples) >= 20 else samples[-1]
+    return '%-14s n=%-4d min %7.2f  median %7.2f  p95 %7.2f  max %7.2f ms' % (
+        name, len(samples), samples[0], statistics.median(samples), p95, samples[-1])
+
+
+def bench(args, key):
+    name, http_port = split_host(args.host, 80)
+    udp = UdpClient(name, args.port, key, args.timeout)
+
+    udp_rtt = []
+    for _ in range(args.count):
+        start = time.perf_counter()
+        udp.request(proto.CMD_CTRL, 0, 0)
+        udp_rtt.append((time.perf_counter() - start) * 1000)
+
+    # Keep-alive connection, i.e. the best case for HTTP
+    http_rtt = []
+    conn = http.client.HTTPConnection(name, http_port, timeout=args.timeout)
+    for _ in range(args.count):
+        start = time.perf_counter()
+        http_ctrl(conn, '/ctrl?key=b0', key)
+        http_rtt.append((time.perf_counter() - start) * 1000)
+    conn.close()
+
+    # New connection per request, as curl does
+    http_new = []
+    for _ in range(args.count):
+        start = time.perf_counter()
+        conn = http.client.HTTPConnection(name, http_port, timeout=args.timeout)
+        http_ctrl(conn, '/ctrl?key=b0', key)
+        conn.close()
+        http_new.append((time.perf_counter() - start) * 1000)
+
+    print(summary('udp', udp_rtt))
+    print(summary('http keepalive', http_rtt))
+    print(summary('http new conn', http_new))
+    return 0
+
+
+def http_status(name, port, timeout):
+    conn = http.client.HTTPConnection(name, port, timeout=timeout)
+    conn.request('GET', '/status')
+    status = json.loads(conn.getresponse().read())
+    conn.close()
+    return status
+
+
+def set_power_save(name, port, profile, timeout, key=None):
+    body = 'wifi_ps=' + profile
+    headers = {'Content-Type': 'application/x-www-form-urlencoded'}
+    headers.update(proto.http_auth_headers(key, 'POST', '/config', body.encode()))
+    conn = http.client.HTTPConnection(name, port, timeout=timeout)
+    conn.request('POST', '/config', body=body, headers=headers)
+    conn.getresponse().read()
+    conn.close()
+
+
+def psbench(args, key):
+    name, http_port = split_host(args.host, 80)
+    udp = UdpClient(name, args.port, key, args.timeout)
+    original = http_status(name, http_port, args.timeout)['wifi']['ps']['profile']
+
+    results = []
+    try:
+        for profile in args.profiles.split(','):
+            set_power_save(name, http_port, profile, args.timeout, key)
+            time.sleep(args.settle)
+            rtt = []
+            for _ in range(args.count):
+                time.sleep(args.gap)
+                start = time.perf_counter()
+                udp.request(proto.CMD_PING)
+                rtt.append((time.perf_counter() - start) * 1000)
+            results.append(summary('ps ' + profile, rtt))
+    finally:
+        set_power_save(name, http_port, original, args.timeout, key)
+
+    for line in results:
+        print(line)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='webkey address, host[:http port]')
+    parser.add_argument('command', choices=sorted(proto.COMMANDS) + ['bench', 'psbench'])
+    parser.add_argument('key', nargs='?', default='', help='selection for ctrl/arm, b1..b4')
+    parser.add_argument('--wait', default='', choices=sorted(proto.MODES))
+    parser.add_argument('--port', type=int, default=proto.DEFAULT_PORT, help='UDP control port')
+    parser.add_argument('--device-key', default='', help='device key, 64 hex digits')
+    parser.add_argument('--timeout', type=float, default=1.0)
+    parser.add_argument('--count', type=int, default=100, help='bench iterations per path')
+    parser.add_argument('--profiles', default='none,min,max,auto', help='psbench profiles to measure')
+    parser.add_argument('--gap', type=float, default=0.3, help='psbench idle seconds between requests')
+    parser.add_argument('--settle', type=float, default=2.0, help='psbench seconds after switching profile')
+    args = parser.parse_args()
+
+    key = proto.parse_key(args.device_key)
+    if args.command == 'bench':
+        return bench(args, key)
+    if args.command == 'psbench':
+        return psbench(args, key)
+
+    button = int(args.key[1:]) if args.key.startswith('b') and args.key[1:].isdigit() else 0
+    client = UdpClient(split_host(args.host, 80)[0], args.port, key, args.timeout)
+    start = time.perf_counter()
+    reply = client.request(proto.COMMANDS[args.command], button, proto.MODES[args.wait])
+    rtt = (time.perf_counter() - start) * 1000
+    print('%s (busy=%d armed=%d) %.2f ms' % (reply['result'], reply['busy'], reply['armed'], rtt))
+    return 0 if reply['status'] == proto.ST_OK else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())